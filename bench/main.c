@@ -0,0 +1,451 @@
+#define _GNU_SOURCE // clock_gettime, setrlimit
+
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+#include "sys/resource.h"
+
+#define VM_TARGET_ARCH64 // for correct vm_size_t
+#include "neovm.h"
+
+// Benchmark suite, writes JSON results to stdout:
+//
+//   bench [-p port] [-t ms] [dispatch] [kernels] [stacks] [tdm] [network]
+//
+// dispatch - every instruction in a straight-line program of VM_BENCH_BLOCK copies,
+// kernels  - inc / dec / add of neovm_types.h on 8..256 bits,
+// stacks   - push / pop pairs of every stack width,
+// tdm      - the same program in 1..1024 threads at quantum 1 and VM_BENCH_QUANTUM,
+// network  - ask / answer round trips between two threads over loopback.
+//
+// Programs run as parsed (not verified), verified, fused and, with VM_JIT, compiled ahead.
+// Every case is run repeatedly for at least -t milliseconds (20 by default), the best of
+// VM_BENCH_TRIALS runs is reported as ns_per_op. Threads of instances bind ports from -p
+// (47000 by default) up to -p + 1023.
+
+#define VM_BENCH_BLOCK 4096 // instructions of dispatch and stacks programs
+#define VM_BENCH_TDM_BLOCK 1024 // instructions of every tdm thread
+#define VM_BENCH_TDM_THREADS 1024
+#define VM_BENCH_QUANTUM 128
+#define VM_BENCH_ROUND_TRIPS 256
+#define VM_BENCH_KERNEL_LOOP 65536
+#define VM_BENCH_TRIALS 5
+#define VM_BENCH_STACK 64
+
+#define VM_BENCH_CODE (VM_BENCH_BLOCK * 40)
+
+// keeps x in memory, so kernels in a loop aren't folded or dropped
+#define VM_BENCH_KEEP(x) __asm__ __volatile__("" : "+m"(x))
+
+
+typedef enum BENCH_FORM{
+    BENCH_PARSED,
+    BENCH_VERIFIED,
+    BENCH_FUSED,
+    BENCH_JIT
+} BENCH_FORM;
+
+#ifdef VM_JIT
+#define BENCH_FORMS 4
+#else
+#define BENCH_FORMS 3
+#endif
+
+const char* benchFormName[4] = {"parsed", "verified", "fused", "jit"};
+
+typedef enum BENCH_INSTR{
+    BENCH_GO,
+    BENCH_SND,
+    BENCH_SND_NUM,
+    BENCH_INC,
+    BENCH_DEC,
+    BENCH_LOCK, // lock, unlock
+    BENCH_PUSH, // push r, pop r
+    BENCH_PUSH_NUM, // push num, pop r
+    BENCH_ASK,
+    BENCH_ANSWER
+} BENCH_INSTR;
+
+// first register of every width: r8, r16, r32, r64, r128, r256
+const vm_uint8_t benchReg[6] = {0, 128, 192, 224, 240, 248};
+
+typedef struct BenchCode{
+    vm_uint8_t bytes[VM_BENCH_CODE];
+    vm_size_t size, count; // bytes, instructions
+} BenchCode;
+
+typedef struct BenchOptions{
+    vm_uint16_t port;
+    double min_ns; // of one trial
+    vm_bool first; // result
+    vm_bool failed;
+} BenchOptions;
+
+BenchOptions bench = {
+    .port = {{0xb7, 0x98}}, // 47000
+    .min_ns = 20e6,
+    .first = true,
+    .failed = false
+};
+
+BenchCode benchCode[2];
+
+
+double benchNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// best ns per op of trials, every trial runs run(arg) until min_ns passes, ops per call
+double benchMeasure(void (*run)(void*), void* arg, vm_size_t ops){
+    vm_size_t reps = 1;
+
+    for(;;){
+        double start = benchNow();
+        for(vm_size_t i = 0; i < reps; i++) run(arg);
+        if(benchNow() - start >= bench.min_ns / 4 || reps >= ((vm_size_t)1 << 40)) break;
+        reps *= 2;
+    }
+    reps *= 4;
+
+    double best = 0;
+    for(int trial = 0; trial < VM_BENCH_TRIALS; trial++){
+        double start = benchNow();
+        for(vm_size_t i = 0; i < reps; i++) run(arg);
+        double elapsed = benchNow() - start;
+        if(trial == 0 || elapsed < best) best = elapsed;
+    }
+    return best / ((double)reps * (double)ops);
+}
+
+void benchResult(const char* group, const char* name, const char* form, vm_size_t threads, vm_size_t quantum, vm_size_t ops, double ns){
+    printf("%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"form\": \"%s\", \"threads\": %zu, \"quantum\": %zu, \"ops\": %zu, \"ns_per_op\": %.3f}",
+           bench.first ? "" : ",", group, name, form, (size_t)threads, (size_t)quantum, (size_t)ops, ns);
+    fflush(stdout);
+    bench.first = false;
+}
+
+void benchError(const char* group, const char* name, const char* form, const char* what){
+    fprintf(stderr, "bench: %s %s (%s): %s\n", group, name, form, what);
+    bench.failed = true;
+}
+
+
+// bytecode
+void benchByte(BenchCode* code, vm_uint8_t byte){
+    code->bytes[code->size++] = byte;
+}
+void benchOp(BenchCode* code, vm_uint8_t icode){
+    benchByte(code, 0x00); benchByte(code, 0x00); benchByte(code, 0x00); benchByte(code, icode);
+    code->count++;
+}
+void benchNumber(BenchCode* code, vm_size_t bytes){
+    for(vm_size_t i = 0; i < bytes; i++) benchByte(code, 0x01);
+}
+void benchNetAddress(BenchCode* code, vm_uint16_t port){
+    benchByte(code, 127); benchByte(code, 0); benchByte(code, 0); benchByte(code, 1);
+    benchByte(code, port.bytes[0]); benchByte(code, port.bytes[1]);
+    benchByte(code, 0); benchByte(code, 0); // thread
+}
+
+// one instruction (or pair) of width 1 << w bytes
+void benchEmit(BenchCode* code, BENCH_INSTR instr, vm_size_t w){
+    vm_uint8_t r = benchReg[w];
+    vm_size_t pc = code->count;
+
+    switch(instr){
+    case BENCH_GO: // go to itself goes on at the next instruction
+        benchOp(code, 0x01);
+        benchByte(code, pc >> 24); benchByte(code, pc >> 16); benchByte(code, pc >> 8); benchByte(code, pc);
+        break;
+    case BENCH_SND: benchOp(code, 0x03); benchByte(code, r); benchByte(code, r + 1); break;
+    case BENCH_SND_NUM: benchOp(code, 0x04 + w); benchNumber(code, 1 << w); benchByte(code, r); break;
+    case BENCH_INC: benchOp(code, 0x1c); benchByte(code, r); benchByte(code, r); break;
+    case BENCH_DEC: benchOp(code, 0x1d); benchByte(code, r); benchByte(code, r); break;
+    case BENCH_LOCK: benchOp(code, 0x1e); benchOp(code, 0x1f); break;
+    case BENCH_PUSH: benchOp(code, 0x10 + w); benchByte(code, r); benchOp(code, 0x16 + w); benchByte(code, r + 1); break;
+    case BENCH_PUSH_NUM: benchOp(code, 0x0a + w); benchNumber(code, 1 << w); benchOp(code, 0x16 + w); benchByte(code, r); break;
+    case BENCH_ASK: benchOp(code, 0x20); benchNetAddress(code, bench.port); break;
+    case BENCH_ANSWER: benchOp(code, 0x21); break;
+    }
+}
+
+void benchFill(BenchCode* code, BENCH_INSTR instr, vm_size_t w, vm_size_t count){
+    code->size = code->count = 0;
+    while(code->count < count) benchEmit(code, instr, w);
+}
+
+
+// programs
+typedef struct BenchRun{
+    VMInstance vm;
+    VMExec* exec;
+    vm_size_t exec_count;
+} BenchRun;
+
+void benchRun(void* arg){
+    BenchRun* run = arg;
+    vmExecProgram(run->exec, run->exec_count, &run->vm, NULL);
+}
+
+// thread i runs code[i % programs], quantum 0 keeps the default scheduler, ops are counted by one run
+void benchPrograms(const char* group, const char* name, BENCH_FORM form, BenchCode** code, vm_size_t programs,
+                   vm_size_t threads, vm_size_t quantum, vm_size_t ops){
+    const char* form_name = benchFormName[form];
+    BenchRun run = {
+        .vm = vmInstance(threads, VM_BENCH_STACK, (vm_uint32_t){127, 0, 0, 1}, bench.port),
+        .exec = malloc(threads * sizeof(VMExec)),
+        .exec_count = threads
+    };
+    VMProgram prog[2];
+    vm_size_t parsed = 0;
+
+    if(run.exec == NULL){
+        benchError(group, name, form_name, "out of memory");
+        goto release;
+    }
+    for(vm_size_t i = 0; i < threads; i++){
+        if(run.vm.thread[i].lock){
+            benchError(group, name, form_name, "port is taken");
+            goto release;
+        }
+    }
+
+    for(; parsed < programs; parsed++){
+        prog[parsed] = vmParseProgram(code[parsed]->bytes, code[parsed]->count, NULL);
+        if(prog[parsed].size != code[parsed]->count){
+            benchError(group, name, form_name, "parsing failed");
+            goto release;
+        }
+        if(form != BENCH_PARSED && !vmVerifyProgram(&prog[parsed], NULL)){
+            benchError(group, name, form_name, "verification failed");
+            parsed++;
+            goto release;
+        }
+        if(form == BENCH_FUSED) vmFuseProgram(&prog[parsed]);
+#ifdef VM_JIT
+        if(form == BENCH_JIT && !vmJitProgram(&prog[parsed])){
+            benchError(group, name, form_name, "compilation failed");
+            parsed++;
+            goto release;
+        }
+        // interpreted forms don't tier up
+        if(form != BENCH_JIT) prog[parsed].heat = VM_JIT_THRESHOLD;
+#endif
+    }
+
+    for(vm_size_t i = 0; i < threads; i++) run.exec[i] = (VMExec){.thread = i, .prog = &prog[i % programs]};
+    if(quantum) vmSetScheduler(&run.vm, VM_SCHED_ROUND_ROBIN, quantum);
+
+    benchRun(&run);
+    if(run.vm.halt){
+        benchError(group, name, form_name, "instance halted");
+        goto release;
+    }
+
+    benchResult(group, name, form_name, threads, quantum, ops, benchMeasure(benchRun, &run, ops));
+
+release:
+    for(vm_size_t i = 0; i < parsed; i++) vmReleaseProgram(&prog[i]);
+    free(run.exec);
+    vmReleaseInstance(&run.vm);
+}
+
+void benchProgram(const char* group, const char* name, BENCH_FORM form, BenchCode* code, vm_size_t threads, vm_size_t quantum){
+    benchPrograms(group, name, form, &code, 1, threads, quantum, code->count * threads);
+}
+
+
+// groups
+const char* benchWidthName[6] = {"8", "16", "32", "64", "128", "256"};
+
+void benchDispatch(){
+    // names are formatted with the width
+    const struct{ BENCH_INSTR instr; const char* name; vm_bool widths; } cases[] = {
+        {BENCH_GO, "go code_adr", false},
+        {BENCH_LOCK, "lock unlock", false},
+        {BENCH_SND, "snd r%s r%s", true},
+        {BENCH_SND_NUM, "snd num%s r%s", true},
+        {BENCH_INC, "inc r%s r%s", true},
+        {BENCH_DEC, "dec r%s r%s", true}
+    };
+    char name[64];
+
+    for(vm_size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++){
+        for(vm_size_t w = 0; w < (cases[c].widths ? 6 : 1); w++){
+            snprintf(name, sizeof(name), cases[c].name, benchWidthName[w], benchWidthName[w]);
+
+            benchFill(&benchCode[0], cases[c].instr, w, VM_BENCH_BLOCK);
+            for(int form = 0; form < BENCH_FORMS; form++) benchProgram("dispatch", name, form, &benchCode[0], 1, 0);
+        }
+    }
+}
+
+void benchStacks(){
+    char name[64];
+
+    for(vm_size_t w = 0; w < 6; w++){
+        snprintf(name, sizeof(name), "push%s r pop%s r", benchWidthName[w], benchWidthName[w]);
+        benchFill(&benchCode[0], BENCH_PUSH, w, VM_BENCH_BLOCK);
+        for(int form = 0; form < BENCH_FORMS; form++) benchProgram("stacks", name, form, &benchCode[0], 1, 0);
+
+        snprintf(name, sizeof(name), "push%s num pop%s r", benchWidthName[w], benchWidthName[w]);
+        benchFill(&benchCode[0], BENCH_PUSH_NUM, w, VM_BENCH_BLOCK);
+        for(int form = 0; form < BENCH_FORMS; form++) benchProgram("stacks", name, form, &benchCode[0], 1, 0);
+    }
+}
+
+// a single thread runs until it blocks whatever quantum is
+void benchTdm(){
+    const vm_size_t quanta[2] = {1, VM_BENCH_QUANTUM};
+
+    benchFill(&benchCode[0], BENCH_INC, 3, VM_BENCH_TDM_BLOCK);
+    for(vm_size_t threads = 1; threads <= VM_BENCH_TDM_THREADS; threads *= 2){
+        for(vm_size_t q = 0; q < 2; q++){
+            for(int form = 0; form < BENCH_FORMS; form++) benchProgram("tdm", "inc r64 r64", form, &benchCode[0], threads, quanta[q]);
+        }
+    }
+}
+
+// thread 0 answers what thread 1 asks, ops are round trips
+void benchNetwork(){
+    BenchCode* code[2] = {&benchCode[0], &benchCode[1]};
+
+    benchFill(code[0], BENCH_ANSWER, 0, VM_BENCH_ROUND_TRIPS);
+    benchFill(code[1], BENCH_ASK, 0, VM_BENCH_ROUND_TRIPS);
+    benchPrograms("network", "ask answer", BENCH_VERIFIED, code, 2, 2, 0, VM_BENCH_ROUND_TRIPS);
+}
+
+// kernels of neovm_types.h, every call depends on the previous one
+void benchInc8(void* arg){
+    vm_uint8_t a = 0;
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = (vm_uint8_t)(a + 1); VM_BENCH_KEEP(a); }
+}
+void benchDec8(void* arg){
+    vm_uint8_t a = 0;
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = (vm_uint8_t)(a - 1); VM_BENCH_KEEP(a); }
+}
+void benchAdd8(void* arg){
+    vm_uint8_t a = 0, b = 0x5a;
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = (vm_uint8_t)(a + b); VM_BENCH_KEEP(a); }
+}
+
+#define _vm_bench_kernels(bitdepth)\
+void _cat(benchInc, bitdepth)(void* arg){\
+    _vm_ui(bitdepth) a = {{0}};\
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = _cat(vm_inc_ui, bitdepth)(a); VM_BENCH_KEEP(a); }\
+}\
+void _cat(benchDec, bitdepth)(void* arg){\
+    _vm_ui(bitdepth) a = {{0}};\
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = _cat(vm_dec_ui, bitdepth)(a); VM_BENCH_KEEP(a); }\
+}\
+void _cat(benchAdd, bitdepth)(void* arg){\
+    _vm_ui(bitdepth) a = {{0}}, b;\
+    memset(b.bytes, 0x5a, sizeof(b.bytes));\
+    for(vm_size_t i = 0; i < VM_BENCH_KERNEL_LOOP; i++){ a = _cat(vm_add_ui, bitdepth)(a, b).result; VM_BENCH_KEEP(a); }\
+}
+
+_vm_bench_kernels(16)
+_vm_bench_kernels(32)
+_vm_bench_kernels(64)
+_vm_bench_kernels(128)
+_vm_bench_kernels(256)
+
+void benchKernels(){
+    void (*const kernels[3][6])(void*) = {
+        {benchInc8, benchInc16, benchInc32, benchInc64, benchInc128, benchInc256},
+        {benchDec8, benchDec16, benchDec32, benchDec64, benchDec128, benchDec256},
+        {benchAdd8, benchAdd16, benchAdd32, benchAdd64, benchAdd128, benchAdd256}
+    };
+    const char* names[3] = {"inc", "dec", "add"};
+    char name[64];
+
+    for(vm_size_t k = 0; k < 3; k++){
+        for(vm_size_t w = 0; w < 6; w++){
+            snprintf(name, sizeof(name), "%s%s", names[k], benchWidthName[w]);
+            benchResult("kernels", name, "native", 1, 0, VM_BENCH_KERNEL_LOOP, benchMeasure(kernels[k][w], NULL, VM_BENCH_KERNEL_LOOP));
+        }
+    }
+}
+
+
+void benchBuild(){
+    printf("  \"build\": {\"threaded_dispatch\": %s, \"native_registers\": %s, \"thread_registers\": %s, \"guarded_stacks\": %s, \"jit\": %s},\n",
+#ifdef VM_THREADED_DISPATCH
+           "true",
+#else
+           "false",
+#endif
+#ifdef VM_NATIVE_REGISTERS
+           "true",
+#else
+           "false",
+#endif
+#ifdef VM_THREAD_REGISTERS
+           "true",
+#else
+           "false",
+#endif
+#ifdef VM_GUARDED_STACKS
+           "true",
+#else
+           "false",
+#endif
+#ifdef VM_JIT
+           "true"
+#else
+           "false"
+#endif
+    );
+}
+
+int main(int argc, char** argv){
+    const struct{ const char* name; void (*run)(); } groups[] = {
+        {"dispatch", benchDispatch},
+        {"kernels", benchKernels},
+        {"stacks", benchStacks},
+        {"tdm", benchTdm},
+        {"network", benchNetwork}
+    };
+    const vm_size_t groups_count = sizeof(groups) / sizeof(groups[0]);
+    vm_bool selected[sizeof(groups) / sizeof(groups[0])] = {false};
+    vm_bool any = false;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-p") == 0 && i + 1 < argc){
+            unsigned port = (unsigned)atoi(argv[++i]);
+            bench.port = (vm_uint16_t){port >> 8, port & 0xff};
+            continue;
+        }
+        if(strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+            bench.min_ns = atof(argv[++i]) * 1e6;
+            continue;
+        }
+
+        vm_size_t g = 0;
+        while(g < groups_count && strcmp(argv[i], groups[g].name) != 0) g++;
+        if(g == groups_count){
+            fprintf(stderr, "usage: %s [-p port] [-t ms] [dispatch] [kernels] [stacks] [tdm] [network]\n", argv[0]);
+            return 1;
+        }
+        selected[g] = any = true;
+    }
+
+    // a socket per VM thread
+    struct rlimit files;
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max){
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    printf("{\n  \"suite\": \"neovm\",\n");
+    benchBuild();
+    printf("  \"results\": [");
+    for(vm_size_t g = 0; g < groups_count; g++){
+        if(!any || selected[g]) groups[g].run();
+    }
+    printf("\n  ]\n}\n");
+
+    return bench.failed ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+#!/usr/local/bin/bash
+
+gcc -O2 -std=c11 -I ../include/ main.c -o bench "$@"
\ No newline at end of file
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+valgrind --leak-check=full ./a.out
\ No newline at end of file
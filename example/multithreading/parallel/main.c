@@ -0,0 +1,57 @@
+#include "stdio.h"
+
+#define VM_TARGET_ARCH64 // for correct vm_size_t
+#include "neovm_parallel.h"
+
+#define THREADS 4
+#define SECTIONS 4
+#define INCS 100
+
+
+int main(){
+    VMInstance vm = vmInstance(THREADS, 8192, (vm_uint32_t){127, 0, 0, 1}, (vm_uint16_t){0xea, 0x70});
+
+    // code (same for every thread)
+    /*
+        pc: assembly              ; bytecode
+        0 : lock                  ; 0x0000001e
+        1 : inc r16_0, r16_0      ; 0x0000001c 0x80 0x80
+        ...
+        100 : inc r16_0, r16_0    ; 0x0000001c 0x80 0x80
+        101 : unlock              ; 0x0000001f
+        ...                       ; SECTIONS times
+    */
+
+    vm_uint8_t code[SECTIONS * (8 + INCS * 6)];
+    vm_size_t size = 0;
+
+    for(vm_size_t i = 0; i < SECTIONS; i++){
+        vm_uint8_t lock[4] = {0x00, 0x00, 0x00, 0x1e};
+        vm_uint8_t inc[6] = {0x00, 0x00, 0x00, 0x1c, 0x80, 0x80};
+        vm_uint8_t unlock[4] = {0x00, 0x00, 0x00, 0x1f};
+
+        for(vm_size_t j = 0; j < 4; j++) code[size++] = lock[j];
+        for(vm_size_t k = 0; k < INCS; k++){
+            for(vm_size_t j = 0; j < 6; j++) code[size++] = inc[j];
+        }
+        for(vm_size_t j = 0; j < 4; j++) code[size++] = unlock[j];
+    }
+
+    VMProgram prog = vmParseProgram(code, SECTIONS * (INCS + 2), NULL);
+
+    VMExec exec[THREADS];
+    for(vm_size_t i = 0; i < THREADS; i++) exec[i] = (VMExec){.thread = i, .prog = &prog};
+
+    vmExecProgramParallel(exec, THREADS, &vm, NULL, 0);
+
+    if(vm.halt)
+        printf("Wrong instruction! VMInstance %p halted\n", &vm);
+
+    printf("r16_0 = %d (expected %d)\n", VM_R8(0, vm) * 256 + VM_R8(1, vm), THREADS * SECTIONS * INCS);
+
+
+    vmReleaseProgram(&prog);
+    vmReleaseInstance(&vm);
+
+    return 0;
+}
@@ -0,0 +1,3 @@
+#!/usr/local/bin/bash
+
+gcc -g -std=c11 -I ../../../include/ main.c
\ No newline at end of file
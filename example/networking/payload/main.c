@@ -0,0 +1,75 @@
+#define _GNU_SOURCE // sendmmsg / recvmmsg
+#include "stdio.h"
+
+#define VM_TARGET_ARCH64 // for correct vm_size_t
+#include "neovm.h"
+
+
+
+int main(){
+    VMInstance vm = vmInstance(2, 8192, (vm_uint32_t){127, 0, 0, 1}, (vm_uint16_t){0xea, 0x60});
+
+    // code0
+    /*
+        pc: assembly                          ; bytecode
+        0 : snd 0x1234, r16_0                 ; 0x00000005 0x1234 0x80
+        1 : send {127.0.0.1 / 60001 / 0}, r16_0 ; 0x00000022 0x7f000001ea610000 0x80
+        2 : push32 0x01020304                 ; 0x0000000c 0x01020304
+        3 : push32 0x05060708                 ; 0x0000000c 0x05060708
+        4 : send32 {127.0.0.1 / 60001 / 0}, 2  ; 0x00000026 0x7f000001ea610000 0x00000002
+    */
+
+    // code1
+    /*
+        pc: assembly    ; bytecode
+        0 : recv r16_4  ; 0x00000023 0x84
+        1 : recv32 2    ; 0x0000002c 0x00000002
+        2 : pop32 r32_0 ; 0x00000018 0xc0
+        3 : pop32 r32_1 ; 0x00000018 0xc1
+    */
+
+    vm_uint8_t code0[52] = {
+        0x00, 0x00, 0x00, 0x05, 0x12, 0x34, 0x80,
+        0x00, 0x00, 0x00, 0x22, 0x7f, 0x00, 0x00, 0x01, 0xea, 0x61, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0x00, 0x0c, 0x01, 0x02, 0x03, 0x04,
+        0x00, 0x00, 0x00, 0x0c, 0x05, 0x06, 0x07, 0x08,
+        0x00, 0x00, 0x00, 0x26, 0x7f, 0x00, 0x00, 0x01, 0xea, 0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02
+    };
+
+    vm_uint8_t code1[23] = {
+        0x00, 0x00, 0x00, 0x23, 0x84,
+        0x00, 0x00, 0x00, 0x2c, 0x00, 0x00, 0x00, 0x02,
+        0x00, 0x00, 0x00, 0x18, 0xc0,
+        0x00, 0x00, 0x00, 0x18, 0xc1
+    };
+
+    VMProgram prog0 = vmParseProgram(code0, 5, NULL);
+    VMProgram prog1 = vmParseProgram(code1, 4, NULL);
+
+    VMExec prog[2] = {
+        (VMExec){
+            .thread = 0,
+            .prog = &prog0
+        },
+        (VMExec){
+            .thread = 1,
+            .prog = &prog1
+        }
+    };
+
+    vmExecProgram(prog, 2, &vm, NULL);
+
+    if(vm.halt)
+        printf("Wrong instruction! VMInstance %p halted\n", &vm);
+
+    printf("r16_4 = 0x%02x%02x\n", VM_R8(8, vm), VM_R8(9, vm));
+    printf("r32_0 = 0x%02x%02x%02x%02x\n", VM_R8(0, vm), VM_R8(1, vm), VM_R8(2, vm), VM_R8(3, vm));
+    printf("r32_1 = 0x%02x%02x%02x%02x\n", VM_R8(4, vm), VM_R8(5, vm), VM_R8(6, vm), VM_R8(7, vm));
+
+
+    vmReleaseProgram(&prog0);
+    vmReleaseProgram(&prog1);
+    vmReleaseInstance(&vm);
+
+    return 0;
+}
@@ -0,0 +1,4 @@
+#!/usr/local/bin/bash
+
+gcc -g -std=c11 -I ../../../include/ main.c -o translate && ./translate
+gcc -g -std=c11 -I ../../../include/ -D TRANSLATED main.c
\ No newline at end of file
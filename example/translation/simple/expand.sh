@@ -0,0 +1,3 @@
+#!/bin/bash
+
+gcc -E -std=c11 -I ../../../include/ -D TRANSLATED main.c | grep -vE '^#' > main_e.c
\ No newline at end of file
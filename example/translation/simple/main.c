@@ -0,0 +1,95 @@
+#include "stdio.h"
+
+#define VM_TARGET_ARCH64 // for correct vm_size_t
+#include "neovm_translate.h"
+
+#ifdef TRANSLATED
+#include "prog.c" // written by the first build
+#endif
+
+
+
+int main(){
+    VMInstance vm = vmInstance(2, 8192, (vm_uint32_t){192, 168, 1, 52}, (vm_uint16_t){0xea, 0x62});
+
+    // code0
+    /*
+        pc: assembly          ; bytecode
+        0 : snd 5, r8_0       ; 0x00000004 0x05 0x00
+        1 : lock              ; 0x0000001e
+        2 : inc r8_0, r8_1    ; 0x0000001c 0x00 0x01
+        3 : inc r8_1, r8_1    ; 0x0000001c 0x01 0x01
+        4 : unlock            ; 0x0000001f
+    */
+
+   // code1
+   /*
+        pc: assembly        ; bytecode
+        0 : snd 2, r8_1     ; 0x00000004 0x02 0x01
+        1 : go 2            ; 0x00000001 0x00000002 (goto, pc 2 is skipped)
+        2 : inc r8_1, r8_1  ; 0x0000001c 0x01 0x01
+        3 : inc r8_1, r8_0  ; 0x0000001c 0x01 0x00
+   */
+
+
+    vm_uint8_t code0[26] = {
+        0x00, 0x00, 0x00, 0x04,
+        0x05, 0x00, 0x00, 0x00,
+        0x00, 0x1e, 0x00, 0x00,
+        0x00, 0x1c, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x1c,
+        0x01, 0x01, 0x00, 0x00,
+        0x00, 0x1f
+    };
+
+    vm_uint8_t code1[26] = {
+        0x00, 0x00, 0x00, 0x04,
+        0x02, 0x01, 0x00, 0x00,
+        0x00, 0x01, 0x00, 0x00,
+        0x00, 0x02, 0x00, 0x00,
+        0x00, 0x1c, 0x01, 0x01,
+        0x00, 0x00, 0x00, 0x1c,
+        0x01, 0x00
+    };
+
+#ifdef TRANSLATED
+    VMProgram prog0 = code0_program(NULL);
+    VMProgram prog1 = code1_program(NULL);
+#else
+    VMLoadError error;
+    FILE* out = fopen("prog.c", "w");
+
+    if(out == NULL || !vmTranslateBytecode(code0, sizeof(code0), NULL, "code0", out, &error)
+                   || !vmTranslateBytecode(code1, sizeof(code1), NULL, "code1", out, &error))
+        printf("Translation failed\n");
+    if(out != NULL) fclose(out);
+
+    VMProgram prog0 = vmLoadProgram(code0, sizeof(code0), NULL, VM_LOAD_VERIFY, &error);
+    VMProgram prog1 = vmLoadProgram(code1, sizeof(code1), NULL, VM_LOAD_VERIFY, &error);
+#endif
+
+    VMExec prog[2] = {
+        (VMExec){
+            .thread = 0,
+            .prog = &prog0
+        },
+        (VMExec){
+            .thread = 1,
+            .prog = &prog1
+        }
+    };
+
+    vmExecProgram(prog, 2, &vm, NULL);
+
+    if(vm.halt)
+        printf("Wrong instruction! VMInstance %p halted\n", &vm);
+
+    printf("r8_0 = %d\nr8_1 = %d\n", VM_R8(0, vm), VM_R8(1, vm));
+
+
+    vmReleaseProgram(&prog0);
+    vmReleaseProgram(&prog1);
+    vmReleaseInstance(&vm);
+
+    return 0;
+}
@@ -0,0 +1,5 @@
+#!/usr/local/bin/bash
+
+# the first build translates programs to prog.c, the second one runs them
+gcc -O2 -std=c11 -I ../../../include/ main.c -o translate && ./translate
+gcc -O2 -std=c11 -I ../../../include/ -D TRANSLATED main.c
\ No newline at end of file
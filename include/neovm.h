@@ -5,9 +5,75 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define VM_HAS_EPOLL
+
+#ifdef _GNU_SOURCE
+#define VM_HAS_MMSG // sendmmsg / recvmmsg
+#define VM_HAS_MEMFD // memfd_create, snapshots are mapped copy-on-write
+#endif
+#endif
+
+#ifdef VM_GUARDED_STACKS
+#include <signal.h>
+#include <setjmp.h>
+
+#if !defined(MAP_ANONYMOUS) || !defined(SA_SIGINFO)
+#error "VM_GUARDED_STACKS requires mmap and sigaction (define _DEFAULT_SOURCE or _GNU_SOURCE before any include)"
+#endif
+#endif
+
+#ifdef VM_JIT
+#include <stddef.h>
+#if !defined(__x86_64__) || !defined(__linux__) || !defined(__GNUC__)
+#error "VM_JIT requires Linux on x86-64 (GCC or Clang)"
+#endif
+#if !defined(VM_TARGET_ARCH64) || !defined(MAP_ANONYMOUS)
+#error "VM_JIT requires VM_TARGET_ARCH64 and mmap (define _DEFAULT_SOURCE or _GNU_SOURCE before any include)"
+#endif
+#endif
+
+#ifdef VM_STATS
+#include <stdio.h>
+#endif
+
+#ifdef VM_PERF
+#include <stdio.h>
+#include <sys/syscall.h>
+#if !defined(__linux__) || !defined(SYS_perf_event_open) || !defined(MAP_ANONYMOUS)
+#error "VM_PERF requires Linux perf events (define _DEFAULT_SOURCE or _GNU_SOURCE before any include)"
+#endif
+#include <linux/perf_event.h>
+#endif
+
+#ifdef VM_TRACE
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define VM_HAS_TSC
+#endif
+#endif
+
+// counted or traced builds run every instruction through the switch interpreter
+#if defined(VM_STATS) || defined(VM_TRACE)
+#define VM_INSTRUMENTED
+#endif
 
 #include "neovm_types.h"
 
+// host-native register file, only little-endian hosts differ from the bytecode order
+#if defined(VM_NATIVE_REGISTERS) && defined(VM_HOST_BIG_ENDIAN)
+    #if !VM_HOST_BIG_ENDIAN
+    #define VM_REGISTERS_LE
+    #endif
+#endif
+
 
 /////////////////////////////////////////
 //              REGISTERS
@@ -45,11 +111,26 @@ typedef struct vm_r256{
 //               VM BASE
 /////////////////////////////////////////
 
+// hot and cold state of threads and instances never share a cache line
+#ifndef VM_CACHE_LINE
+#define VM_CACHE_LINE 64
+#endif
+
+// register bank of a thread with VM_THREAD_REGISTERS, same layout as registers of VMInstance
+typedef struct VMRegisters{
+    _Alignas(VM_CACHE_LINE) vm_r256 r0;
+    vm_r256 r1, r2, r3;
+} VMRegisters;
+
 typedef struct VMThread{
-    vm_uint256_t pc; // program counter
+    // touched by every instruction and by the scheduler
+    _Alignas(VM_CACHE_LINE) vm_size_t pc; // program counter, converted to 256-bit only by instructions using it
     vm_bool lock, wait;
+    vm_uint8_t priority; // class for VM_SCHED_PRIORITY, higher runs first
+    vm_size_t nrecv; // stack elements left to receive
 
-    int sock; // client / server socket
+    // network
+    _Alignas(VM_CACHE_LINE) int sock; // client / server socket
 
     vm_uint8_t nbuf8; // 8-bit net buffer
     vm_uint16_t nbuf16;
@@ -57,128 +138,823 @@ typedef struct VMThread{
     vm_uint64_t nbuf64;
     vm_uint128_t nbuf128;
     vm_uint256_t nbuf256;
+
+#ifdef VM_THREAD_REGISTERS
+    VMRegisters regs; // own registers, instance registers are shared by lds / sts
+#endif
 } VMThread;
 
 
+// synchronization of lock / unlock when threads really run in parallel
+struct VMInstance;
+
+typedef struct VMSync{
+    void (*lock)(struct VMInstance* vm, vm_size_t thread);
+    void (*unlock)(struct VMInstance* vm, vm_size_t thread);
+    void* data;
+} VMSync;
+
+
+// TDM scheduling
+#define VM_SCHED_PRIORITIES 4
+#define VM_SCHED_UNTIL_BLOCK ((vm_size_t)-1)
+
+typedef enum VM_SCHED_POLICY{
+    VM_SCHED_ROUND_ROBIN, // every ready thread runs quantum instructions in turn
+    VM_SCHED_RUN_UNTIL_BLOCK, // thread runs until it waits, is locked or ends
+    VM_SCHED_PRIORITY // round robin inside the highest class having ready threads
+} VM_SCHED_POLICY;
+
+typedef struct VMScheduler{
+    VM_SCHED_POLICY policy;
+    vm_size_t quantum; // instructions per turn
+    vm_size_t epoch; // changed by lock / unlock, ready queues are rebuilt then
+} VMScheduler;
+
+
+#ifdef VM_STATS
+// executions of one icode, superinstructions count as their parts
+typedef struct VMIcodeCount{
+    vm_uint32_t icode;
+    vm_size_t count;
+} VMIcodeCount;
+
+typedef struct VMThreadStats{
+    vm_size_t executed; // instructions
+    vm_size_t slices; // turns given by the scheduler
+    vm_size_t waits; // turns ended waiting for the network
+    vm_size_t locked; // turns of other threads run while this one was locked out
+    vm_size_t halts; // turns halting the instance
+
+    // executions per pc of the program run last, earlier programs are kept by icode only
+    const struct VMProgram* prog;
+    vm_size_t prog_id; // stats_id of prog, a program parsed again at the same address has another one
+    vm_size_t* pc;
+    vm_uint32_t* pc_icode; // icode at every pc, programs may be released before stats are read
+    vm_size_t pc_size;
+
+    VMIcodeCount* icode; // earlier programs
+    vm_size_t icode_count;
+    vm_size_t locked_at; // turns of the instance when the thread was locked out
+} VMThreadStats;
+
+typedef struct VMStats{
+    VMThreadStats* thread; // per thread of the instance
+    vm_size_t threads_count;
+    vm_size_t turns; // slices run by all threads
+
+    VMIcodeCount* icode; // all threads and programs ordered by icode, filled by vmGetStats
+    vm_size_t icode_count;
+} VMStats;
+
+typedef enum VM_STATS_FORMAT{
+    VM_STATS_TEXT,
+    VM_STATS_CSV
+} VM_STATS_FORMAT;
+#endif
+
+#ifdef VM_TRACE
+typedef enum VM_TRACE_EVENT{
+    VM_TRACE_EXEC, // instruction at pc ran, superinstructions give a record for every part
+    VM_TRACE_SLICE, // turn of the thread begins at pc
+    VM_TRACE_YIELD, // turn ends at pc
+    VM_TRACE_WAIT, // turn ends waiting for the network
+    VM_TRACE_LOCK, // thread locked the others out
+    VM_TRACE_UNLOCK,
+    VM_TRACE_HALT // instance halted by the thread
+} VM_TRACE_EVENT;
+
+// 24 bytes, written to trace files as they are
+typedef struct VMTraceRecord{
+    uint64_t tsc; // timestamp counter (nanoseconds without it)
+    uint32_t thread;
+    uint32_t pc;
+    vm_uint32_t icode; // zero for events other than VM_TRACE_EXEC
+    uint32_t event; // VM_TRACE_EVENT
+} VMTraceRecord;
+
+typedef struct VMTrace{
+    VMTraceRecord* record; // ring, the oldest records are overwritten
+    uint64_t mask; // capacity - 1, capacity is a power of two
+    uint64_t head; // records taken since vmTraceStart
+
+    uint64_t tsc_start, ns_start; // clocks at vmTraceStart, to convert timestamps
+} VMTrace;
+
+// trace files: header and records from the oldest one, in host byte order
+#define VM_TRACE_MAGIC 0x544d564e // "NVMT"
+#define VM_TRACE_VERSION 1
+
+typedef struct VMTraceHeader{
+    uint32_t magic, version;
+    uint32_t record_size; // sizeof(VMTraceRecord)
+    uint32_t tsc; // timestamps are timestamp counter ticks, nanoseconds if 0
+    uint64_t count, lost; // records in the file, older records overwritten in the ring
+    uint64_t tsc_start, ns_start, tsc_end, ns_end; // both clocks at vmTraceStart and vmTraceWrite
+} VMTraceHeader;
+#endif
+
+#ifdef VM_PERF
+// host counters, events the host doesn't have stay zero
+typedef enum VM_PERF_EVENT{
+    VM_PERF_CYCLES,
+    VM_PERF_INSTRUCTIONS,
+    VM_PERF_BRANCH_MISSES,
+    VM_PERF_L1D_MISSES, // L1 data cache read misses
+    VM_PERF_LLC_MISSES, // last level cache misses
+    VM_PERF_TASK_CLOCK, // nanoseconds on cpu, a software event available without a PMU
+    VM_PERF_EVENTS
+} VM_PERF_EVENT;
+
+typedef enum VM_PERF_MODE{
+    VM_PERF_RUN, // runs of vmExecProgram / vmResumeProgram only
+    VM_PERF_SLICES, // every slice too, counts go to VM threads
+    VM_PERF_OPCODES // every instruction alone, counts go to VM threads and opcodes (slow)
+} VM_PERF_MODE;
+
+typedef struct VMPerfCounts{
+    uint64_t value[VM_PERF_EVENTS];
+} VMPerfCounts;
+
+typedef struct VMPerf{
+    VM_PERF_MODE mode;
+    int fd[VM_PERF_EVENTS]; // -1 for events not available, the first open one leads the group
+    int slot[VM_PERF_EVENTS]; // place of the event in a group read
+    int leader, members;
+
+    VMPerfCounts total; // all runs, with scheduling
+    VMPerfCounts* thread; // per VM thread, VM_PERF_SLICES and VM_PERF_OPCODES
+    vm_size_t threads_count;
+
+    // VM_PERF_OPCODES: counts and executions per VM_OPCODE, superinstructions run as their first part
+    VMPerfCounts* op;
+    uint64_t* op_count;
+} VMPerf;
+#endif
+
+
 typedef struct VMInstance{
     // registers
-    vm_r256 r0, r1, r2, r3;
-    vm_uint256_t se256, se128, se64, se32, se16, se8;
-    vm_bool halt;
+    _Alignas(VM_CACHE_LINE) vm_r256 r0;
+    vm_r256 r1, r2, r3;
 
+    _Alignas(VM_CACHE_LINE) vm_size_t se256; // stacks ending pointers
+    vm_size_t se128, se64, se32, se16, se8;
+    vm_bool halt;
+    _Atomic vm_bool suspend; // set by vmSuspend (from any thread), execution stops before the next instruction
     VMThread* thread;
-    vm_size_t threads_count;
-
-    vm_uint32_t ip;
-    vm_uint16_t port;
 
     // stacks
-    vm_uint256_t* stack256;
+    _Alignas(VM_CACHE_LINE) vm_uint256_t* stack256;
     vm_uint128_t* stack128;
     vm_uint64_t* stack64;
     vm_uint32_t* stack32;
     vm_uint16_t* stack16;
     vm_uint8_t* stack8;
+    vm_size_t threads_count;
+
+    _Alignas(VM_CACHE_LINE) vm_size_t sc256; // stacks capacities
+    vm_size_t sc128, sc64, sc32, sc16, sc8;
+    vm_size_t stack_size; // bytes of each stack given to vmInstance
+
+    // cold
+    _Alignas(VM_CACHE_LINE) vm_uint32_t ip;
+    vm_uint16_t port;
 
-    vm_size_t stack_size;
+    const VMSync* sync; // NULL for TDM
+    VMScheduler sched;
+
+    void* arena; // threads and stacks (stacks are mmaped with VM_GUARDED_STACKS)
+    vm_bool arena_owned; // allocated by vmInstance / vmInstanceStacks / vmFork
+    vm_size_t arena_mapped; // bytes mapped from a snapshot by vmFork, 0 for heap arena
+#ifdef VM_STATS
+    VMStats* stats; // allocated by the first run or vmGetStats
+#endif
+#ifdef VM_TRACE
+    VMTrace* trace; // set by vmTraceStart, NULL when not tracing
+#endif
+#ifdef VM_PERF
+    VMPerf* perf; // set by vmPerfStart, NULL when not profiling
+#endif
 } VMInstance;
 
+// stacks capacities for vmInstanceStacks, in values
+typedef struct VMStacks{
+    vm_size_t s256, s128, s64, s32, s16, s8;
+} VMStacks;
+
+// warmed-up instance for vmFork, image is the arena rounded to pages
+// followed by stacks mapped outside of it (VM_GUARDED_STACKS)
+typedef struct VMSnapshot{
+    VMInstance vm; // registers, stacks ending pointers, capacities and scheduler, no memory
+    vm_size_t arena_size;
+    vm_size_t size; // bytes of the image
+
+    int fd; // file of the image for copy-on-write forks, -1 if there is none
+    vm_size_t offset; // of the image in fd
+    vm_uint8_t* image; // NULL if forks only map fd
+
+    vm_size_t copy_max; // forks copy threads and used stacks up to this size, larger ones are mapped
+} VMSnapshot;
+
+
+vm_size_t _vmPageSize(){
+    return (vm_size_t)sysconf(_SC_PAGESIZE);
+}
+vm_size_t _vmPageBytes(vm_size_t bytes){
+    vm_size_t page = _vmPageSize();
+    return (bytes + page - 1) / page * page;
+}
+
+// instance arena, every part starts on a cache line
+typedef struct VMArena{
+    vm_uint8_t* cursor;
+} VMArena;
+
+vm_size_t _vmArenaBytes(vm_size_t bytes){
+    return (bytes + VM_CACHE_LINE - 1) / VM_CACHE_LINE * VM_CACHE_LINE;
+}
+
+void* _vmArenaTake(VMArena* arena, vm_size_t bytes){
+    if(bytes == 0) return NULL;
+
+    void* result = arena->cursor;
+    arena->cursor += _vmArenaBytes(bytes);
+
+    return result;
+}
+
+
+// stacks memory
+#ifdef VM_GUARDED_STACKS
+// every stack is reserved with mmap between two inaccessible guard pages, pages
+// are committed on first touch and push / pop past the ends fault into a guard,
+// the fault handler halts the instance executed by the faulting OS thread
+typedef struct VMFault{
+    sigjmp_buf env;
+    const VMInstance* vm;
+    struct VMFault* prev;
+} VMFault;
+
+_Thread_local VMFault* _vm_fault = NULL;
+
+struct sigaction _vm_fault_prev[2]; // SIGSEGV, SIGBUS
+vm_bool _vm_fault_installed = false;
+
+vm_bool _vmStackGuardHit(const void* stack, vm_size_t bytes, const void* adr){
+    const vm_uint8_t* base = stack;
+    const vm_uint8_t* at = adr;
+    vm_size_t page = _vmPageSize();
+
+    if(base == NULL) return false;
+    return (at >= base - page && at < base) || (at >= base + bytes && at < base + bytes + page);
+}
+
+void _vmFaultHandler(int sig, siginfo_t* info, void* context){
+    const VMFault* fault = _vm_fault;
+
+    if(fault != NULL){
+        const VMInstance* vm = fault->vm;
+        const void* adr = info->si_addr;
+
+        if(_vmStackGuardHit(vm->stack8, vm->sc8 * sizeof(*vm->stack8), adr) ||
+           _vmStackGuardHit(vm->stack16, vm->sc16 * sizeof(*vm->stack16), adr) ||
+           _vmStackGuardHit(vm->stack32, vm->sc32 * sizeof(*vm->stack32), adr) ||
+           _vmStackGuardHit(vm->stack64, vm->sc64 * sizeof(*vm->stack64), adr) ||
+           _vmStackGuardHit(vm->stack128, vm->sc128 * sizeof(*vm->stack128), adr) ||
+           _vmStackGuardHit(vm->stack256, vm->sc256 * sizeof(*vm->stack256), adr)) siglongjmp(((VMFault*)fault)->env, 1);
+    }
+
+    // not a stack fault, it goes to the previous handler and this one stays installed
+    const struct sigaction* prev = _vm_fault_prev + (sig == SIGBUS);
+
+    if(prev->sa_flags & SA_SIGINFO) prev->sa_sigaction(sig, info, context);
+    else if(prev->sa_handler != SIG_DFL && prev->sa_handler != SIG_IGN) prev->sa_handler(sig);
+    else{
+        // default action, a fault can't be ignored; the next guarded instance installs this handler again
+        sigaction(sig, prev, NULL);
+        _vm_fault_installed = false;
+        raise(sig);
+    }
+}
+
+void _vmFaultInstall(){
+    if(_vm_fault_installed) return;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = _vmFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER; // left by siglongjmp, so the signal must stay unblocked
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, _vm_fault_prev);
+    sigaction(SIGBUS, &action, _vm_fault_prev + 1);
+    _vm_fault_installed = true;
+}
+
+// guarded stacks are not in the arena
+vm_size_t _vmStackBytes(vm_size_t count, vm_size_t size){
+    return 0;
+}
+
+// capacity is rounded up so the end of the stack meets the guard page
+void* _vmStackAlloc(VMArena* arena, vm_size_t* count, vm_size_t size){
+    vm_size_t page = _vmPageSize();
+    vm_size_t bytes = (*count * size + page - 1) / page * page;
+
+    if(bytes == 0) return NULL;
+
+    // a stack that fails to map has zero capacity, _vmInstanceCarve halts the instance then
+    *count = 0;
+
+    vm_uint8_t* area = mmap(NULL, bytes + 2 * page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(area == MAP_FAILED) return NULL;
+
+    if(mprotect(area + page, bytes, PROT_READ | PROT_WRITE) != 0){
+        munmap(area, bytes + 2 * page);
+        return NULL;
+    }
+#if defined(VM_STACK_HUGEPAGES) && defined(MADV_HUGEPAGE)
+    madvise(area + page, bytes, MADV_HUGEPAGE);
+#endif
+
+    _vmFaultInstall();
+
+    *count = bytes / size;
+    return area + page;
+}
+void _vmStackFree(void* stack, vm_size_t count, vm_size_t size){
+    vm_size_t page = _vmPageSize();
+    if(stack != NULL) munmap((vm_uint8_t*)stack - page, count * size + 2 * page);
+}
+
+// runs call, stack fault inside it halts vm
+#define VM_FAULT_GUARD(vm, call) do{\
+    VMFault _fault = {.vm = (vm), .prev = _vm_fault};\
+    _vm_fault = &_fault;\
+    if(sigsetjmp(_fault.env, 0) == 0){ call; }\
+    else (vm)->halt = true;\
+    _vm_fault = _fault.prev;\
+}while(0)
+#else
+vm_size_t _vmStackBytes(vm_size_t count, vm_size_t size){
+    return _vmArenaBytes(count * size);
+}
+
+void* _vmStackAlloc(VMArena* arena, vm_size_t* count, vm_size_t size){
+    return _vmArenaTake(arena, *count * size);
+}
+void _vmStackFree(void* stack, vm_size_t count, vm_size_t size){
+    // released with the arena
+}
+
+#define VM_FAULT_GUARD(vm, call) do{ call; }while(0)
+#endif
+
+
+// client / server socket on port + thread
+int _vmThreadSocket(VMInstance* vm, vm_size_t thread){
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    struct sockaddr_in adr;
+    adr.sin_family = AF_INET;
+    memcpy(&adr.sin_addr.s_addr, vm->ip.bytes, 4);
+    adr.sin_port = htons((uint16_t)((vm->port.bytes[0] << 8 | vm->port.bytes[1]) + thread));
+
+    if(bind(sock, (const struct sockaddr*)&adr, sizeof(adr)) < 0) vm->thread[thread].lock = true;
+
+    return sock;
+}
+
 VMThread _vmThread(VMInstance* vm, vm_size_t thread){
     VMThread result;
 
-    result.pc = (vm_uint256_t){
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00
-    };
+    result.pc = 0;
     result.lock = false;
     result.wait = false;
+    result.priority = 0;
+    result.nrecv = 0;
 
+#ifdef VM_THREAD_REGISTERS
+    memset(&result.regs, 0, sizeof(result.regs));
+#endif
 
-    // network
-    result.sock = socket(AF_INET, SOCK_DGRAM, 0);
-
-    struct sockaddr_in adr;
-    adr.sin_family = AF_INET;
-    adr.sin_addr.s_addr = *((uint32_t*)&vm->ip);
-    adr.sin_port = htons(ntohs(*((uint16_t*)&vm->port)) + thread);
 
-    if(bind(result.sock, (const struct sockaddr*)&adr, sizeof(adr)) < 0) vm->thread[thread].lock = true;
+    // network
+    result.sock = _vmThreadSocket(vm, thread);
 
     return result;
 }
 
+// forked threads have no socket (-1) until their first network instruction
+int _vmSocket(vm_size_t thread, VMInstance* vm){
+    if(vm->thread[thread].sock < 0) vm->thread[thread].sock = _vmThreadSocket(vm, thread);
+    return vm->thread[thread].sock;
+}
+
 void _vmReleaseThread(VMThread* thread){
-    thread->pc = (vm_uint256_t){
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00
-    };
+    thread->pc = 0;
     thread->lock = false;
     thread->wait = false;
 
-    close(thread->sock);
-    thread->sock = 0;
+    if(thread->sock >= 0) close(thread->sock);
+    thread->sock = -1;
+    thread->nrecv = 0;
 }
 
-VMInstance vmInstance(vm_size_t threads_count, vm_size_t stack_size, vm_uint32_t ip, vm_uint16_t port){
+// bytes of the arena vmInstanceArena needs for threads_count threads and stacks
+vm_size_t vmInstanceArenaSize(vm_size_t threads_count, VMStacks stacks){
+    return _vmArenaBytes(threads_count * sizeof(VMThread))
+        + _vmStackBytes(stacks.s256, sizeof(vm_uint256_t))
+        + _vmStackBytes(stacks.s128, sizeof(vm_uint128_t))
+        + _vmStackBytes(stacks.s64, sizeof(vm_uint64_t))
+        + _vmStackBytes(stacks.s32, sizeof(vm_uint32_t))
+        + _vmStackBytes(stacks.s16, sizeof(vm_uint16_t))
+        + _vmStackBytes(stacks.s8, sizeof(vm_uint8_t));
+}
+
+// threads and stacks pointers of vm->arena, same layout for the same capacities,
+// false if some stack couldn't be allocated (it has zero capacity then)
+vm_bool _vmInstanceCarve(VMInstance* vm, vm_size_t threads_count, VMStacks stacks){
+    VMArena part = {.cursor = vm->arena};
+
+    // setup threads
+    vm->threads_count = threads_count;
+    vm->thread = _vmArenaTake(&part, threads_count * sizeof(VMThread));
+
+    // setup stacks
+    vm->sc256 = stacks.s256;
+    vm->sc128 = stacks.s128;
+    vm->sc64 = stacks.s64;
+    vm->sc32 = stacks.s32;
+    vm->sc16 = stacks.s16;
+    vm->sc8 = stacks.s8;
+
+    vm->stack256 = _vmStackAlloc(&part, &vm->sc256, sizeof(*vm->stack256));
+    vm->stack128 = _vmStackAlloc(&part, &vm->sc128, sizeof(*vm->stack128));
+    vm->stack64 = _vmStackAlloc(&part, &vm->sc64, sizeof(*vm->stack64));
+    vm->stack32 = _vmStackAlloc(&part, &vm->sc32, sizeof(*vm->stack32));
+    vm->stack16 = _vmStackAlloc(&part, &vm->sc16, sizeof(*vm->stack16));
+    vm->stack8 = _vmStackAlloc(&part, &vm->sc8, sizeof(*vm->stack8));
+
+    return (vm->stack256 != NULL || stacks.s256 == 0) && (vm->stack128 != NULL || stacks.s128 == 0)
+        && (vm->stack64 != NULL || stacks.s64 == 0) && (vm->stack32 != NULL || stacks.s32 == 0)
+        && (vm->stack16 != NULL || stacks.s16 == 0) && (vm->stack8 != NULL || stacks.s8 == 0);
+}
+
+// arena is caller memory aligned to VM_CACHE_LINE, it must outlive the instance
+VMInstance vmInstanceArena(void* arena, vm_size_t arena_size, vm_size_t threads_count, VMStacks stacks, vm_uint32_t ip, vm_uint16_t port){
     VMInstance result = {
         .halt = false,
         .ip = ip, 
-        .port = port
+        .port = port,
+        .sched = {.policy = VM_SCHED_ROUND_ROBIN, .quantum = 1},
+        .arena = arena,
+        .arena_owned = false
     };
 
-    // setup stack
-    if(stack_size != 0){
-        result.stack8 = malloc(stack_size);
-        result.stack16 = malloc(stack_size / 2);
-        result.stack32 = malloc(stack_size / 4);
-        result.stack64 = malloc(stack_size / 8);
-        result.stack128 = malloc(stack_size / 16);
-        result.stack256 = malloc(stack_size / 32);
-    }else{
-        result.stack8 = NULL;
-        result.stack16 = NULL;
-        result.stack32 = NULL;
-        result.stack64 = NULL;
-        result.stack128 = NULL;
-        result.stack256 = NULL;
+    vm_size_t need = vmInstanceArenaSize(threads_count, stacks);
+    if((need > 0 && arena == NULL) || arena_size < need || (size_t)arena % VM_CACHE_LINE != 0){
+        // do some exception here
+        result.halt = true;
+        return result;
     }
 
-    // setup threads
-    result.threads_count = threads_count;
-    result.thread = malloc(threads_count * sizeof(VMThread));
-
+    // out of memory for guarded stacks, the rest is released by vmReleaseInstance
+    if(!_vmInstanceCarve(&result, threads_count, stacks)){
+        result.halt = true;
+        result.threads_count = 0;
+        return result;
+    }
     for(vm_size_t i = 0; i < threads_count; i++) result.thread[i] = _vmThread(&result, i);
 
     return result;
 }
 
+VMInstance vmInstanceStacks(vm_size_t threads_count, VMStacks stacks, vm_uint32_t ip, vm_uint16_t port){
+    vm_size_t size = vmInstanceArenaSize(threads_count, stacks);
+    void* arena = size > 0 ? aligned_alloc(VM_CACHE_LINE, size) : NULL;
+
+    VMInstance result = vmInstanceArena(arena, size, threads_count, stacks, ip, port);
+    result.arena_owned = true;
+
+    return result;
+}
+
+// every stack gets stack_size bytes
+VMInstance vmInstance(vm_size_t threads_count, vm_size_t stack_size, vm_uint32_t ip, vm_uint16_t port){
+    VMStacks stacks = {
+        .s8 = stack_size,
+        .s16 = stack_size / 2,
+        .s32 = stack_size / 4,
+        .s64 = stack_size / 8,
+        .s128 = stack_size / 16,
+        .s256 = stack_size / 32
+    };
+
+    VMInstance result = vmInstanceStacks(threads_count, stacks, ip, port);
+    result.stack_size = stack_size;
+
+    return result;
+}
+
+#ifdef VM_STATS
+void _vmReleaseStats(VMStats* stats){
+    for(vm_size_t i = 0; i < stats->threads_count; i++){
+        free(stats->thread[i].pc);
+        free(stats->thread[i].pc_icode);
+        free(stats->thread[i].icode);
+    }
+    free(stats->thread);
+    free(stats->icode);
+    free(stats);
+}
+#endif
+
+#ifdef VM_TRACE
+uint64_t _vmTraceNs(){
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+uint64_t _vmTraceClock(){
+#ifdef VM_HAS_TSC
+    return __rdtsc();
+#else
+    return _vmTraceNs();
+#endif
+}
+
+void vmTraceStop(VMInstance* vm){
+    if(vm->trace != NULL){
+        free(vm->trace->record);
+        free(vm->trace);
+    }
+    vm->trace = NULL;
+}
+
+// records from now on go to a ring of capacity records (rounded up to a power of two),
+// a trace started before is dropped, false if out of memory
+vm_bool vmTraceStart(VMInstance* vm, vm_size_t capacity){
+    vmTraceStop(vm);
+
+    uint64_t size = 1;
+    while(size < capacity) size <<= 1;
+
+    VMTrace* trace = malloc(sizeof(VMTrace));
+    VMTraceRecord* record = trace != NULL ? malloc(size * sizeof(VMTraceRecord)) : NULL;
+    if(record == NULL){
+        free(trace);
+        return false;
+    }
+
+    *trace = (VMTrace){.record = record, .mask = size - 1, .head = 0, .tsc_start = _vmTraceClock(), .ns_start = _vmTraceNs()};
+    vm->trace = trace;
+    return true;
+}
+#endif
+
+#ifdef VM_PERF
+void vmPerfStop(VMInstance* vm){
+    VMPerf* perf = vm->perf;
+    if(perf == NULL) return;
+
+    for(vm_size_t i = 0; i < VM_PERF_EVENTS; i++){
+        if(perf->fd[i] >= 0) close(perf->fd[i]);
+    }
+    free(perf->thread);
+    free(perf->op);
+    free(perf->op_count);
+    free(perf);
+    vm->perf = NULL;
+}
+#endif
+
 void vmReleaseInstance(VMInstance* vm){
     for(vm_size_t i = 0; i < vm->threads_count; i++) _vmReleaseThread(vm->thread + i);
+#ifdef VM_STATS
+    if(vm->stats != NULL) _vmReleaseStats(vm->stats);
+    vm->stats = NULL;
+#endif
+#ifdef VM_TRACE
+    vmTraceStop(vm);
+#endif
+#ifdef VM_PERF
+    vmPerfStop(vm);
+#endif
 
     vm->threads_count = 0;
     vm->stack_size = 0;
     vm->ip = (vm_uint32_t){0, 0, 0, 0};
     vm->port = (vm_uint16_t){0, 0};
 
-    free(vm->thread);
-    free(vm->stack8);
-    free(vm->stack16);
-    free(vm->stack32);
-    free(vm->stack64);
-    free(vm->stack128);
-    free(vm->stack256);
+    _vmStackFree(vm->stack8, vm->sc8, sizeof(*vm->stack8));
+    _vmStackFree(vm->stack16, vm->sc16, sizeof(*vm->stack16));
+    _vmStackFree(vm->stack32, vm->sc32, sizeof(*vm->stack32));
+    _vmStackFree(vm->stack64, vm->sc64, sizeof(*vm->stack64));
+    _vmStackFree(vm->stack128, vm->sc128, sizeof(*vm->stack128));
+    _vmStackFree(vm->stack256, vm->sc256, sizeof(*vm->stack256));
+
+    if(vm->arena_mapped > 0) munmap(vm->arena, vm->arena_mapped);
+    else if(vm->arena_owned) free(vm->arena);
+
+    vm->thread = NULL;
+    vm->arena = NULL;
+    vm->arena_mapped = 0;
+    vm->stack8 = NULL, vm->stack16 = NULL, vm->stack32 = NULL;
+    vm->stack64 = NULL, vm->stack128 = NULL, vm->stack256 = NULL;
+    vm->sc8 = vm->sc16 = vm->sc32 = vm->sc64 = vm->sc128 = vm->sc256 = 0;
+}
+
+// snapshots
+VMStacks _vmStacksOf(const VMInstance* vm){
+    return (VMStacks){
+        .s256 = vm->sc256, .s128 = vm->sc128, .s64 = vm->sc64,
+        .s32 = vm->sc32, .s16 = vm->sc16, .s8 = vm->sc8
+    };
+}
+
+// stacks from 256 to 8 bits: memory, capacity and used bytes
+void _vmStackParts(const VMInstance* vm, vm_uint8_t** stack, vm_size_t* bytes, vm_size_t* used){
+    #define _vm_stack_part(i, bitdepth)\
+        stack[i] = (vm_uint8_t*)vm->stack##bitdepth;\
+        bytes[i] = vm->sc##bitdepth * sizeof(*vm->stack##bitdepth);\
+        used[i] = vm->se##bitdepth * sizeof(*vm->stack##bitdepth);
+
+    _vm_stack_part(0, 256)
+    _vm_stack_part(1, 128)
+    _vm_stack_part(2, 64)
+    _vm_stack_part(3, 32)
+    _vm_stack_part(4, 16)
+    _vm_stack_part(5, 8)
+
+    #undef _vm_stack_part
+}
+
+// forks copy only threads and used parts of stacks, memory with more of them
+// than this is mapped copy-on-write instead (VM_HAS_MEMFD)
+#ifndef VM_FORK_COPY_MAX
+#define VM_FORK_COPY_MAX (64 * 1024)
+#endif
+
+// captures registers, stacks and threads (pc, lock, wait, net buffers) of vm between executions
+VMSnapshot vmSnapshot(const VMInstance* vm){
+    VMSnapshot result = {.vm = *vm, .fd = -1, .offset = 0, .image = NULL, .copy_max = VM_FORK_COPY_MAX};
+
+    vm_uint8_t* stack[6];
+    vm_size_t bytes[6], used[6];
+    _vmStackParts(vm, stack, bytes, used);
+
+    result.arena_size = vmInstanceArenaSize(vm->threads_count, _vmStacksOf(vm));
+    result.size = _vmPageBytes(result.arena_size);
+#ifdef VM_GUARDED_STACKS
+    for(vm_size_t i = 0; i < 6; i++) result.size += bytes[i];
+#endif
+
+    // pointers of vm mean nothing to forks
+    result.vm.thread = NULL;
+    result.vm.stack256 = NULL, result.vm.stack128 = NULL, result.vm.stack64 = NULL;
+    result.vm.stack32 = NULL, result.vm.stack16 = NULL, result.vm.stack8 = NULL;
+    result.vm.arena = NULL;
+    result.vm.arena_owned = false;
+    result.vm.arena_mapped = 0;
+    result.vm.sync = NULL;
+
+    if(result.size == 0) return result;
+
+#ifdef VM_HAS_MEMFD
+    // forks map the file privately and see what is written through the shared mapping
+    result.fd = memfd_create("neovm-snapshot", MFD_CLOEXEC);
+    if(result.fd >= 0 && ftruncate(result.fd, result.size) == 0){
+        result.image = mmap(NULL, result.size, PROT_READ | PROT_WRITE, MAP_SHARED, result.fd, 0);
+        if(result.image == MAP_FAILED) result.image = NULL;
+    }
+#else
+    result.image = malloc(result.size);
+#endif
+    if(result.image == NULL){
+        // do some exception here
+        result.vm.halt = true;
+        return result;
+    }
+
+    memcpy(result.image, vm->arena, result.arena_size);
+
+#ifdef VM_GUARDED_STACKS
+    vm_size_t offset = _vmPageBytes(result.arena_size);
+    for(vm_size_t i = 0; i < 6; i++){
+        if(stack[i] != NULL) memcpy(result.image + offset, stack[i], bytes[i]);
+        offset += bytes[i];
+    }
+#endif
+
+    return result;
+}
+
+void vmReleaseSnapshot(VMSnapshot* snap){
+    if(snap->fd >= 0){
+        if(snap->image != NULL) munmap(snap->image, snap->size);
+        close(snap->fd);
+    }else free(snap->image);
+
+    snap->fd = -1;
+    snap->image = NULL;
+    snap->arena_size = 0;
+    snap->size = 0;
+}
+
+vm_bool _vmForkMaps(const VMSnapshot* snap, vm_size_t copied){
+    return snap->fd >= 0 && copied > snap->copy_max;
+}
+
+// new instance on ip / port starting from the snapshot, sockets are bound on first use
+VMInstance vmFork(const VMSnapshot* snap, vm_uint32_t ip, vm_uint16_t port){
+    VMInstance result = snap->vm;
+    result.ip = ip;
+    result.port = port;
+    result.arena_owned = true;
+#ifdef VM_STATS
+    result.stats = NULL; // counts of the forked instance start from zero
+#endif
+#ifdef VM_TRACE
+    result.trace = NULL;
+#endif
+#ifdef VM_PERF
+    result.perf = NULL;
+#endif
+
+    vm_uint8_t* stack[6];
+    vm_size_t bytes[6], used[6];
+    _vmStackParts(&snap->vm, stack, bytes, used);
+
+    vm_size_t copied = snap->vm.threads_count * sizeof(VMThread);
+#ifndef VM_GUARDED_STACKS
+    for(vm_size_t i = 0; i < 6; i++) copied += used[i];
+#endif
+
+    // arena
+    void* arena = NULL;
+    if(!snap->vm.halt && snap->arena_size > 0){
+        if(_vmForkMaps(snap, copied)){
+            vm_size_t mapped = _vmPageBytes(snap->arena_size);
+
+            arena = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE, snap->fd, snap->offset);
+            if(arena == MAP_FAILED) arena = NULL;
+            else result.arena_mapped = mapped;
+        }else arena = aligned_alloc(VM_CACHE_LINE, snap->arena_size);
+    }
+
+    if(snap->vm.halt || (arena == NULL && snap->arena_size > 0)){
+        // do some exception here
+        result.halt = true;
+        result.threads_count = 0;
+        result.sc256 = result.sc128 = result.sc64 = result.sc32 = result.sc16 = result.sc8 = 0;
+        return result;
+    }
+
+    result.arena = arena;
+    if(!_vmInstanceCarve(&result, snap->vm.threads_count, _vmStacksOf(&snap->vm))){
+        result.halt = true;
+        result.threads_count = 0;
+        return result;
+    }
+    _vmStackParts(&result, stack, bytes, used);
+
+    if(result.arena_mapped == 0 && result.threads_count > 0) memcpy(result.thread, snap->image, result.threads_count * sizeof(VMThread));
+
+    // stacks, values past the end are never read
+#ifdef VM_GUARDED_STACKS
+    vm_size_t offset = _vmPageBytes(snap->arena_size);
+#endif
+    for(vm_size_t i = 0; i < 6; i++){
+#ifdef VM_GUARDED_STACKS
+        vm_size_t at = offset;
+        offset += bytes[i];
+
+        if(stack[i] != NULL && _vmForkMaps(snap, used[i])){
+            if(mmap(stack[i], bytes[i], PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, snap->fd, snap->offset + at) == MAP_FAILED) result.halt = true;
+            continue;
+        }
+#else
+        vm_size_t at = stack[i] - (vm_uint8_t*)result.arena;
+        if(result.arena_mapped > 0) continue; // already in the mapped arena
+#endif
+        if(stack[i] != NULL && used[i] > 0) memcpy(stack[i], snap->image + at, used[i]);
+    }
+
+    for(vm_size_t i = 0; i < result.threads_count; i++) result.thread[i].sock = -1;
+
+    return result;
+}
+
+// quantum is ignored by VM_SCHED_RUN_UNTIL_BLOCK, 0 is treated as 1
+void vmSetScheduler(VMInstance* vm, VM_SCHED_POLICY policy, vm_size_t quantum){
+    vm->sched.policy = policy;
+    vm->sched.quantum = quantum == 0 ? 1 : quantum;
+}
+void vmSetThreadPriority(VMInstance* vm, vm_size_t thread, vm_uint8_t priority){
+    if(thread < vm->threads_count) vm->thread[thread].priority = priority < VM_SCHED_PRIORITIES ? priority : VM_SCHED_PRIORITIES - 1;
 }
 
 
@@ -212,12 +988,117 @@ void vmReleaseInstance(VMInstance* vm){
 #define VM_R256_INDEX_INBOUNDS(index) ((index >= VM_R256_START) && (index < VM_R256_END))
 
 
-#define VM_R8(reg, vm) ((vm_r8*)&(vm).r0)[(reg) % VM_R8_COUNT]
-#define VM_R16(reg, vm) ((vm_r16*)&(vm).r0)[(reg) % VM_R16_COUNT]
-#define VM_R32(reg, vm) ((vm_r32*)&(vm).r0)[(reg) % VM_R32_COUNT]
-#define VM_R64(reg, vm) ((vm_r64*)&(vm).r0)[(reg) % VM_R64_COUNT]
-#define VM_R128(reg, vm) ((vm_r128*)&(vm).r0)[(reg) % VM_R128_COUNT]
-#define VM_R256(reg, vm) ((vm_r256*)&(vm).r0)[(reg) % VM_R256_COUNT]
+// byte offset of a register in the register file
+#ifdef VM_REGISTERS_LE
+// every r256 is stored as a little-endian number, so a sub register
+// keeps its aliasing but moves to the mirrored place inside its r256
+#define VM_REG_OFFSET(index, size) ((((index) * (size)) & ~31) + 32 - (((index) * (size)) & 31) - (size))
+#else
+#define VM_REG_OFFSET(index, size) ((index) * (size))
+#endif
+
+// registers used by instructions of a thread: own bank with VM_THREAD_REGISTERS or instance registers
+#ifdef VM_THREAD_REGISTERS
+#define VM_BANK_OF(thread_ptr, vm) ((thread_ptr)->regs)
+#else
+#define VM_BANK_OF(thread_ptr, vm) (*(vm))
+#endif
+#define VM_BANK(t, vm) VM_BANK_OF((vm)->thread + (t), vm)
+
+#define VM_R8(reg, vm) (*(vm_r8*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R8_COUNT, 1)))
+#define VM_R16(reg, vm) (*(vm_r16*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R16_COUNT, 2)))
+#define VM_R32(reg, vm) (*(vm_r32*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R32_COUNT, 4)))
+#define VM_R64(reg, vm) (*(vm_r64*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R64_COUNT, 8)))
+#define VM_R128(reg, vm) (*(vm_r128*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R128_COUNT, 16)))
+#define VM_R256(reg, vm) (*(vm_r256*)((vm_uint8_t*)&(vm).r0 + VM_REG_OFFSET((reg) % VM_R256_COUNT, 32)))
+
+
+// register values, bytecode numbers are big-endian
+#ifdef VM_REGISTERS_LE
+void _vm_reg_from_num(void* reg, const void* num, vm_size_t size){
+    for(vm_size_t i = 0; i < size; i++) ((vm_uint8_t*)reg)[i] = ((const vm_uint8_t*)num)[size - i - 1];
+}
+void _vm_nums_swap(void* nums, vm_size_t count, vm_size_t size){
+    vm_uint8_t* num = nums;
+
+    for(vm_size_t n = 0; n < count; n++, num += size){
+        for(vm_size_t i = 0; i < size / 2; i++){
+            vm_uint8_t byte = num[i];
+            num[i] = num[size - i - 1];
+            num[size - i - 1] = byte;
+        }
+    }
+}
+vm_size_t _vm_r256_to_size_t(const vm_r256* reg){
+    vm_size_t result;
+    memcpy(&result, reg, sizeof(result));
+    return result;
+}
+
+#define _vm_reg_native_arith(bitdepth, type)\
+void _cat(_vm_reg_inc, bitdepth)(void* to, const void* from){\
+    type value;\
+    memcpy(&value, from, sizeof(value));\
+    value++;\
+    memcpy(to, &value, sizeof(value));\
+}\
+void _cat(_vm_reg_dec, bitdepth)(void* to, const void* from){\
+    type value;\
+    memcpy(&value, from, sizeof(value));\
+    value--;\
+    memcpy(to, &value, sizeof(value));\
+}
+#define _vm_reg_limbs_arith(bitdepth)\
+void _cat(_vm_reg_inc, bitdepth)(void* to, const void* from){\
+    vm_limb_t value[bitdepth / 64];\
+    vm_limb_t carry = 1;\
+    memcpy(value, from, sizeof(value));\
+    for(vm_size_t i = 0; i < bitdepth / 64; i++) carry = _vm_addc_limb(value[i], 0, carry, value + i, _vm_limb_size);\
+    memcpy(to, value, sizeof(value));\
+}\
+void _cat(_vm_reg_dec, bitdepth)(void* to, const void* from){\
+    vm_limb_t value[bitdepth / 64];\
+    vm_limb_t borrow = 1;\
+    memcpy(value, from, sizeof(value));\
+    for(vm_size_t i = 0; i < bitdepth / 64; i++) borrow = _vm_subb_limb(value[i], 0, borrow, value + i, _vm_limb_size);\
+    memcpy(to, value, sizeof(value));\
+}
+
+_vm_reg_native_arith(16, unsigned short)
+_vm_reg_native_arith(32, unsigned int)
+_vm_reg_native_arith(64, unsigned long long)
+_vm_reg_limbs_arith(128)
+_vm_reg_limbs_arith(256)
+#else
+void _vm_reg_from_num(void* reg, const void* num, vm_size_t size){
+    memcpy(reg, num, size);
+}
+void _vm_nums_swap(void* nums, vm_size_t count, vm_size_t size){}
+vm_size_t _vm_r256_to_size_t(const vm_r256* reg){
+    return vm_ui256_to_size_t(*(const vm_uint256_t*)reg);
+}
+
+#define _vm_reg_be_arith(bitdepth)\
+void _cat(_vm_reg_inc, bitdepth)(void* to, const void* from){\
+    *(_vm_ui(bitdepth)*)to = _cat(vm_inc_ui, bitdepth)(*(const _vm_ui(bitdepth)*)from);\
+}\
+void _cat(_vm_reg_dec, bitdepth)(void* to, const void* from){\
+    *(_vm_ui(bitdepth)*)to = _cat(vm_dec_ui, bitdepth)(*(const _vm_ui(bitdepth)*)from);\
+}
+
+_vm_reg_be_arith(16)
+_vm_reg_be_arith(32)
+_vm_reg_be_arith(64)
+_vm_reg_be_arith(128)
+_vm_reg_be_arith(256)
+#endif
+
+void _vm_reg_inc8(void* to, const void* from){
+    *(vm_r8*)to = *(const vm_r8*)from + 1;
+}
+void _vm_reg_dec8(void* to, const void* from){
+    *(vm_r8*)to = *(const vm_r8*)from - 1;
+}
 
 
 // Instruction
@@ -229,6 +1110,44 @@ typedef enum _VM_OPERAND_SIZE{
     UINT128_T = 16, UINT256_T = 32
 } VM_OPERAND_SIZE;
 
+// opcodes of the base instruction set, in _GIDT order
+typedef enum _VM_OPCODE{
+    VM_OP_EXT = 0, // extension or unresolved instruction
+    VM_OP_GO_ADR, VM_OP_GO_R,
+    VM_OP_SND_R_R,
+    VM_OP_SND_NUM_R8, VM_OP_SND_NUM_R16, VM_OP_SND_NUM_R32, VM_OP_SND_NUM_R64, VM_OP_SND_NUM_R128, VM_OP_SND_NUM_R256,
+    VM_OP_PUSH8_NUM, VM_OP_PUSH16_NUM, VM_OP_PUSH32_NUM, VM_OP_PUSH64_NUM, VM_OP_PUSH128_NUM, VM_OP_PUSH256_NUM,
+    VM_OP_PUSH8_R, VM_OP_PUSH16_R, VM_OP_PUSH32_R, VM_OP_PUSH64_R, VM_OP_PUSH128_R, VM_OP_PUSH256_R,
+    VM_OP_POP8, VM_OP_POP16, VM_OP_POP32, VM_OP_POP64, VM_OP_POP128, VM_OP_POP256,
+    VM_OP_INC_R_R, VM_OP_DEC_R_R,
+    VM_OP_ASK, VM_OP_ANSWER,
+    VM_OP_LOCK, VM_OP_UNLOCK,
+    VM_OP_SEND_R, VM_OP_RECV_R,
+    VM_OP_SEND8, VM_OP_SEND16, VM_OP_SEND32, VM_OP_SEND64, VM_OP_SEND128, VM_OP_SEND256,
+    VM_OP_RECV8, VM_OP_RECV16, VM_OP_RECV32, VM_OP_RECV64, VM_OP_RECV128, VM_OP_RECV256,
+    VM_OP_LDS, VM_OP_STS,
+
+    // unchecked forms set by vmVerifyProgram, in _FIDT order, they run on decoded operands
+    VM_OP_GO_R256,
+    VM_OP_SND_R8_R8, VM_OP_SND_R16_R16, VM_OP_SND_R32_R32, VM_OP_SND_R64_R64, VM_OP_SND_R128_R128, VM_OP_SND_R256_R256,
+    VM_OP_SND_NUM8_R8, VM_OP_SND_NUM16_R16, VM_OP_SND_NUM32_R32, VM_OP_SND_NUM64_R64, VM_OP_SND_NUM128_R128, VM_OP_SND_NUM256_R256,
+    VM_OP_PUSH8_R8, VM_OP_PUSH16_R16, VM_OP_PUSH32_R32, VM_OP_PUSH64_R64, VM_OP_PUSH128_R128, VM_OP_PUSH256_R256,
+    VM_OP_POP8_R8, VM_OP_POP16_R16, VM_OP_POP32_R32, VM_OP_POP64_R64, VM_OP_POP128_R128, VM_OP_POP256_R256,
+    VM_OP_INC_R8_R8, VM_OP_INC_R16_R16, VM_OP_INC_R32_R32, VM_OP_INC_R64_R64, VM_OP_INC_R128_R128, VM_OP_INC_R256_R256,
+    VM_OP_DEC_R8_R8, VM_OP_DEC_R16_R16, VM_OP_DEC_R32_R32, VM_OP_DEC_R64_R64, VM_OP_DEC_R128_R128, VM_OP_DEC_R256_R256,
+    VM_OP_GO_PC,
+    VM_OP_PUSH8_IMM, VM_OP_PUSH16_IMM, VM_OP_PUSH32_IMM, VM_OP_PUSH64_IMM, VM_OP_PUSH128_IMM, VM_OP_PUSH256_IMM,
+    VM_OP_ASK_ADR,
+
+    // superinstructions set by vmFuseProgram, in _FIDT order
+    VM_OP_SND_INC8, VM_OP_SND_INC16, VM_OP_SND_INC32, VM_OP_SND_INC64, VM_OP_SND_INC128, VM_OP_SND_INC256,
+    VM_OP_PUSH_POP8, VM_OP_PUSH_POP16, VM_OP_PUSH_POP32, VM_OP_PUSH_POP64, VM_OP_PUSH_POP128, VM_OP_PUSH_POP256,
+    VM_OP_POP_PUSH8, VM_OP_POP_PUSH16, VM_OP_POP_PUSH32, VM_OP_POP_PUSH64, VM_OP_POP_PUSH128, VM_OP_POP_PUSH256,
+    VM_OP_INC_RUN8, VM_OP_INC_RUN16, VM_OP_INC_RUN32, VM_OP_INC_RUN64, VM_OP_INC_RUN128, VM_OP_INC_RUN256,
+    VM_OP_LOCKED,
+    VM_OPCODES_COUNT
+} VM_OPCODE;
+
 
 #define VM_FREE_IMPL(impl) (((void(*)(vm_size_t, VMInstance*))(impl)))
 #define VM_SINGLE_IMPL(impl) (((void(*)(const void*, vm_size_t, VMInstance*))(impl)))
@@ -256,20 +1175,104 @@ typedef struct VMInstructionDescriptorsExt{
 } VMInstructionDescriptorsExt;
 
 
+typedef struct VMInstructionRegistry{
+    const VMInstructionDescriptor** slot; // open addressing by icode
+    vm_size_t capacity; // power of two
+    vm_size_t size;
+    vm_bool collision; // some icode was registered twice, programs aren't parsed with it
+} VMInstructionRegistry;
+
+
+#define VM_DESC_NONE UINT32_MAX
+
+// 16 bytes without pointers: icode is a byte offset in code of the program and operands follow it,
+// verified instructions also carry their operands decoded
 typedef struct VMInstruction{
-    const vm_uint32_t* icode;
-    const void* op0;
-    const void* op1;
-    const void* op2;
+    uint32_t icode;
+    uint16_t op; // VM_OPCODE
+    uint8_t op1, op2; // offsets of second and third operands from icode, first one is right after icode
+
+    uint8_t r0, r1; // decoded registers: byte offsets in the register file
+    uint16_t base; // superinstruction: op of its first instruction alone
+    union{
+        uint32_t desc; // VM_OP_EXT: index in desc of the program, VM_DESC_NONE if unresolved
+        uint32_t imm; // decoded number up to 32 bits in registers byte order, or target of go
+        uint32_t pool; // decoded wider number or network address: offset in pool of the program
+    };
 } VMInstruction;
 
+#define _VM_OPERAND_AT0(instr) sizeof(vm_uint32_t)
+#define _VM_OPERAND_AT1(instr) (instr)->op1
+#define _VM_OPERAND_AT2(instr) (instr)->op2
+#define VM_OPERAND(code, instr, n) ((const void*)((code) + (instr)->icode + _VM_OPERAND_AT##n(instr)))
+
+struct VMExec;
+
 typedef struct VMProgram{
     VMInstruction* program;
     vm_size_t size;
+
+    const vm_uint8_t* code; // copy of parsed bytecode
+    vm_size_t code_size;
+
+    const VMInstructionDescriptor** desc; // extension instructions used by the program
+    vm_size_t desc_count;
+
+    vm_uint8_t* pool; // decoded operands not fitting an instruction
+    vm_size_t pool_size;
+
+    void* image; // mapping of vmLoadProgramImage, NULL for parsed programs
+    vm_size_t image_size;
+
+    // C code of vmTranslateProgram running up to quantum instructions, NULL for interpreted programs
+    vm_size_t (*slice)(const struct VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext);
+
+#ifdef VM_JIT
+    vm_size_t heat; // instructions run by the interpreter
+    struct VMJitCode* jit; // native code, NULL until the program gets hot
+#endif
+
+#ifdef VM_STATS
+    vm_size_t stats_id; // given by the first counted run, 0 until then and after vmReleaseProgram
+#endif
 } VMProgram;
 
+#ifdef VM_JIT
+typedef struct VMJitCode{
+    vm_uint8_t* code; // executable mapping
+    vm_size_t size;
+    vm_size_t table; // offset of entries: offsets of instructions from code as int32_t
+} VMJitCode;
+#endif
+
 void vmReleaseProgram(VMProgram* prog){
-    free(prog->program);
+    if(prog->image != NULL) munmap(prog->image, prog->image_size);
+    else{
+        free(prog->program);
+        free((void*)prog->code);
+    }
+    free(prog->desc);
+    free(prog->pool);
+
+#ifdef VM_JIT
+    if(prog->jit != NULL){
+        munmap(prog->jit->code, prog->jit->size);
+        free(prog->jit);
+    }
+    prog->jit = NULL;
+    prog->heat = 0;
+#endif
+#ifdef VM_STATS
+    prog->stats_id = 0;
+#endif
+
+    prog->program = NULL;
+    prog->code = NULL;
+    prog->desc = NULL;
+    prog->pool = NULL;
+    prog->image = NULL;
+    prog->slice = NULL;
+    prog->size = prog->code_size = prog->desc_count = prog->pool_size = prog->image_size = 0;
 }
 
 typedef struct VMExec{
@@ -278,10 +1281,152 @@ typedef struct VMExec{
 } VMExec;
 
 typedef struct VMParser{
-    VMInstruction instr;
+    VMInstruction instr; // offsets from the start of parsed bytecode
+    const VMInstructionDescriptor* desc; // NULL if instruction is unknown
     const vm_uint8_t* next;
 } VMParser;
 
+#ifdef VM_TRACE
+// records are taken without locks, parallel workers only race for the slot index
+void _vmTrace(VMTrace* trace, vm_size_t thread, vm_size_t pc, const vm_uint8_t* icode, VM_TRACE_EVENT event){
+    if(trace == NULL) return;
+
+#ifdef __GNUC__
+    uint64_t at = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+#else
+    uint64_t at = trace->head++;
+#endif
+    VMTraceRecord* record = trace->record + (at & trace->mask);
+
+    record->tsc = _vmTraceClock();
+    record->thread = thread;
+    record->pc = pc;
+    if(icode != NULL) memcpy(&record->icode, icode, sizeof(vm_uint32_t));
+    else record->icode = (vm_uint32_t){{0, 0, 0, 0}};
+    record->event = event;
+}
+
+void _vmTraceInstr(VMTrace* trace, const VMExec* exec, vm_size_t pc){
+    _vmTrace(trace, exec->thread, pc, exec->prog->code + exec->prog->program[pc].icode, VM_TRACE_EXEC);
+}
+#endif
+
+#ifdef VM_STATS
+// stats of the instance, allocated on first use, NULL if out of memory
+VMStats* _vmStats(VMInstance* vm){
+    if(vm->stats != NULL) return vm->stats;
+
+    VMStats* stats = calloc(1, sizeof(VMStats));
+    if(stats == NULL) return NULL;
+
+    stats->threads_count = vm->threads_count;
+    stats->thread = calloc(vm->threads_count > 0 ? vm->threads_count : 1, sizeof(VMThreadStats));
+    if(stats->thread == NULL){
+        free(stats);
+        return NULL;
+    }
+
+    vm->stats = stats;
+    return stats;
+}
+
+// adds count executions of icode, table stays ordered by icode
+vm_bool _vmIcodeAdd(VMIcodeCount** table, vm_size_t* size, vm_uint32_t icode, vm_size_t count){
+    vm_size_t at = 0;
+    while(at < *size && memcmp(&(*table)[at].icode, &icode, sizeof(vm_uint32_t)) < 0) at++;
+
+    if(at < *size && memcmp(&(*table)[at].icode, &icode, sizeof(vm_uint32_t)) == 0){
+        (*table)[at].count += count;
+        return true;
+    }
+
+    VMIcodeCount* grown = realloc(*table, (*size + 1) * sizeof(VMIcodeCount));
+    if(grown == NULL) return false;
+
+    memmove(grown + at + 1, grown + at, (*size - at) * sizeof(VMIcodeCount));
+    grown[at] = (VMIcodeCount){.icode = icode, .count = count};
+    *table = grown;
+    (*size)++;
+    return true;
+}
+
+// pc counts of thread go to its icode counts of earlier programs
+void _vmStatsFold(VMThreadStats* stats){
+    for(vm_size_t i = 0; i < stats->pc_size; i++){
+        if(stats->pc[i] > 0) _vmIcodeAdd(&stats->icode, &stats->icode_count, stats->pc_icode[i], stats->pc[i]);
+    }
+}
+
+// pc counts of the thread for prog, counts of the program run before are folded
+// programs are told apart by id, an address may be reused by a program parsed again
+vm_size_t _vmStatsProgramId(VMProgram* prog){
+    static vm_size_t last = 0;
+
+#ifdef __GNUC__
+    vm_size_t id = __atomic_load_n(&prog->stats_id, __ATOMIC_ACQUIRE);
+
+    if(id == 0){
+        vm_size_t expected = 0;
+        id = __atomic_add_fetch(&last, 1, __ATOMIC_RELAXED);
+        if(!__atomic_compare_exchange_n(&prog->stats_id, &expected, id, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) id = expected; // taken by a parallel worker
+    }
+    return id;
+#else
+    if(prog->stats_id == 0) prog->stats_id = ++last;
+    return prog->stats_id;
+#endif
+}
+
+void _vmStatsProgram(VMThreadStats* stats, VMProgram* prog){
+    vm_size_t id = _vmStatsProgramId(prog);
+    if(stats->prog_id == id) return;
+
+    _vmStatsFold(stats);
+    free(stats->pc);
+    free(stats->pc_icode);
+
+    stats->prog = prog;
+    stats->prog_id = id;
+    stats->pc = calloc(prog->size > 0 ? prog->size : 1, sizeof(vm_size_t));
+    stats->pc_icode = malloc((prog->size > 0 ? prog->size : 1) * sizeof(vm_uint32_t));
+    stats->pc_size = prog->size;
+
+    if(stats->pc == NULL || stats->pc_icode == NULL){
+        free(stats->pc);
+        free(stats->pc_icode);
+        stats->pc = NULL;
+        stats->pc_icode = NULL;
+        stats->pc_size = 0;
+        stats->prog_id = 0; // tried again next slice
+        return;
+    }
+
+    for(vm_size_t i = 0; i < prog->size; i++) memcpy(stats->pc_icode + i, prog->code + prog->program[i].icode, sizeof(vm_uint32_t));
+}
+
+// slices of all threads
+vm_size_t _vmStatsTurns(const VMStats* stats){
+    vm_size_t result = 0;
+    for(vm_size_t i = 0; i < stats->threads_count; i++) result += stats->thread[i].slices;
+    return result;
+}
+
+// holder locks or unlocks the others, called before their lock flags change
+// (in parallel the others are stopped by then)
+void _vmStatsLocked(VMInstance* vm, vm_size_t holder, vm_bool lock){
+    if(vm->stats == NULL) return;
+
+    vm_size_t turns = _vmStatsTurns(vm->stats);
+    for(vm_size_t i = 0; i < vm->stats->threads_count; i++){
+        VMThreadStats* stats = vm->stats->thread + i;
+
+        if(i == holder || vm->thread[i].lock == lock) continue;
+        if(lock) stats->locked_at = turns;
+        else stats->locked += turns - stats->locked_at;
+    }
+}
+#endif
+
 
 
 /////////////////////////////////////////////////////
@@ -290,72 +1435,342 @@ typedef struct VMParser{
 
 // more info on https://github.com/architector1324/NeoVM
 
-void _vm_go_adr(const vm_uint256_t* adr, vm_size_t thread, VMInstance* vm){
+void _vm_go_adr(const vm_uint32_t* adr, vm_size_t thread, VMInstance* vm){
     // go adr
-    vm->thread[thread].pc = *adr;
+    vm->thread[thread].pc = vm_ui32_to_size_t(*adr);
 }
 void _vm_go_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     // go r256
     vm_uint8_t _reg = *reg;
 
     if(VM_R256_INDEX_INBOUNDS(_reg))
-        vm->thread[thread].pc = VM_UINT256_T(VM_R256(_reg - 248, *vm));
+        vm->thread[thread].pc = _vm_r256_to_size_t(&VM_R256(_reg - 248, VM_BANK(thread, vm)));
     else vm->halt = true;
 }
 
-void _vm_ask(const vm_uint64_t* nadr, vm_size_t thread, VMInstance* vm){
-    vm_bool hang = true;
+// network address {ip / port / thread}, thread is not used yet
+struct sockaddr_in _vmNetAddress(const vm_uint64_t* nadr){
+    struct sockaddr_in adr = {.sin_family = AF_INET};
 
-    struct sockaddr_in adr;
+    // both are big-endian in bytecode as in sockaddr_in
+    memcpy(&adr.sin_addr.s_addr, nadr->bytes, 4);
+    memcpy(&adr.sin_port, nadr->bytes + 4, 2);
 
-    vm_uint16_t port = {nadr->bytes[4], nadr->bytes[5]};
-    vm_uint32_t ip = {nadr->bytes[0], nadr->bytes[1], nadr->bytes[2], nadr->bytes[3]};
+    return adr;
+}
 
-    adr.sin_family = AF_INET; 
-    adr.sin_port = *((const uint16_t*)&port);
-    adr.sin_addr.s_addr = *((const uint32_t*)&ip);
+void _vmAsk(const struct sockaddr_in* adr, vm_size_t thread, VMInstance* vm){
+    vm_bool hang = true;
 
     if(vm->thread[thread].wait == false){
-        sendto(vm->thread[thread].sock, &hang, 1, MSG_CONFIRM, (const struct sockaddr*)&adr, sizeof(adr));
+        sendto(_vmSocket(thread, vm), &hang, 1, MSG_CONFIRM, (const struct sockaddr*)adr, sizeof(*adr));
         vm->thread[thread].wait = true;
     }
 
-    int len;
-    if(recvfrom(vm->thread[thread].sock, &hang, 1, MSG_DONTWAIT, NULL, &len) > 0) vm->thread[thread].wait = false;
+    if(recvfrom(_vmSocket(thread, vm), &hang, 1, MSG_DONTWAIT, NULL, NULL) > 0) vm->thread[thread].wait = false;
 
     int dump = 0;
 }
+void _vm_ask(const vm_uint64_t* nadr, vm_size_t thread, VMInstance* vm){
+    struct sockaddr_in adr = _vmNetAddress(nadr);
+    _vmAsk(&adr, thread, vm);
+}
 void _vm_answer(vm_size_t thread, VMInstance* vm){
     vm_bool hang = true;
     vm->thread[thread].wait = true;
 
-    int len;
-
     struct sockaddr_in adr;
+    socklen_t len = sizeof(adr);
 
-    if(recvfrom(vm->thread[thread].sock, &hang, 1, MSG_DONTWAIT, (struct sockaddr*)&adr, &len) > 0){
-        sendto(vm->thread[thread].sock, &hang, 1, MSG_CONFIRM, (const struct sockaddr*)&adr, sizeof(adr));
+    if(recvfrom(_vmSocket(thread, vm), &hang, 1, MSG_DONTWAIT, (struct sockaddr*)&adr, &len) > 0){
+        sendto(_vmSocket(thread, vm), &hang, 1, MSG_CONFIRM, (const struct sockaddr*)&adr, sizeof(adr));
         vm->thread[thread].wait = false;
     }
 }
 
-void _vm_snd_r_r(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t thread, VMInstance* vm){
-    // snd from_r, to_r
-    vm_uint8_t _reg0 = *reg0;
-    vm_uint8_t _reg1 = *reg1;
+// payload networking: registers go through net buffers, stacks are sent and received in place
+#ifndef VM_NET_PAYLOAD
+#define VM_NET_PAYLOAD 1024 // stack bytes per datagram
+#endif
+#define VM_NET_BURST 32 // datagrams per sendmmsg / recvmmsg
+
+// register and net buffer of its width, returns the width or 0 for wrong register
+vm_size_t _vmNetRegister(vm_uint8_t reg, VMThread* thread, VMInstance* vm, void** r, void** nbuf){
+    if(VM_R8_INDEX_INBOUNDS(reg)){
+        *r = &VM_R8(reg - VM_R8_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf8;
+        return 1;
+    }else if(VM_R16_INDEX_INBOUNDS(reg)){
+        *r = &VM_R16(reg - VM_R16_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf16;
+        return 2;
+    }else if(VM_R32_INDEX_INBOUNDS(reg)){
+        *r = &VM_R32(reg - VM_R32_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf32;
+        return 4;
+    }else if(VM_R64_INDEX_INBOUNDS(reg)){
+        *r = &VM_R64(reg - VM_R64_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf64;
+        return 8;
+    }else if(VM_R128_INDEX_INBOUNDS(reg)){
+        *r = &VM_R128(reg - VM_R128_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf128;
+        return 16;
+    }else if(VM_R256_INDEX_INBOUNDS(reg)){
+        *r = &VM_R256(reg - VM_R256_END, VM_BANK_OF(thread, vm));
+        *nbuf = &thread->nbuf256;
+        return 32;
+    }
+    return 0;
+}
 
-    if(VM_R8_INDEX_INBOUNDS(_reg0) && VM_R8_INDEX_INBOUNDS(_reg1))
-        VM_R8(_reg1 - VM_R8_END, *vm) = VM_R8(_reg0 - VM_R8_END, *vm);
+void _vm_send_r(const vm_uint64_t* nadr, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
+    // send {adr}, r
+    VMThread* _thread = &vm->thread[thread];
+    void *r, *nbuf;
+
+    vm_size_t size = _vmNetRegister(*reg, _thread, vm, &r, &nbuf);
+
+    if(size != 0){
+        struct sockaddr_in adr = _vmNetAddress(nadr);
+
+        _vm_reg_from_num(nbuf, r, size); // same byte order change both ways
+        sendto(_vmSocket(thread, vm), nbuf, size, MSG_CONFIRM, (const struct sockaddr*)&adr, sizeof(adr));
+    }else vm->halt = true;
+}
+void _vm_recv_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
+    // recv r
+    VMThread* _thread = &vm->thread[thread];
+    void *r, *nbuf;
+
+    vm_size_t size = _vmNetRegister(*reg, _thread, vm, &r, &nbuf);
+
+    if(size != 0){
+        _thread->wait = true;
+
+        ssize_t len = recv(_vmSocket(thread, vm), nbuf, size, MSG_DONTWAIT);
+        if(len >= 0){
+            // shorter payload is a smaller number
+            memmove((vm_uint8_t*)nbuf + size - len, nbuf, len);
+            memset(nbuf, 0, size - len);
+
+            _vm_reg_from_num(r, nbuf, size);
+            _thread->wait = false;
+        }
+    }else vm->halt = true;
+}
+
+// pop count elements and send them, VM_NET_PAYLOAD bytes per datagram
+void _vmNetSendStack(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_uint8_t* stack, vm_size_t* se, vm_size_t size, vm_size_t thread, VMInstance* vm){
+    vm_size_t _count = vm_ui32_to_size_t(*count);
+
+    if(_count > *se){
+        vm->halt = true;
+        return;
+    }
+
+    *se -= _count;
+
+    vm_uint8_t* data = stack + *se * size;
+    vm_size_t bytes = _count * size;
+    vm_size_t chunk = VM_NET_PAYLOAD / size * size;
+
+    int sock = _vmSocket(thread, vm);
+    struct sockaddr_in adr = _vmNetAddress(nadr);
+
+    _vm_nums_swap(data, _count, size); // popped, so converted in place
+
+#ifdef VM_HAS_MMSG
+    struct mmsghdr msg[VM_NET_BURST];
+    struct iovec iov[VM_NET_BURST];
+
+    while(bytes > 0){
+        unsigned int n = 0;
+
+        for(; n < VM_NET_BURST && bytes > 0; n++){
+            vm_size_t len = bytes < chunk ? bytes : chunk;
+
+            iov[n] = (struct iovec){.iov_base = data, .iov_len = len};
+            msg[n] = (struct mmsghdr){
+                .msg_hdr = {.msg_name = &adr, .msg_namelen = sizeof(adr), .msg_iov = iov + n, .msg_iovlen = 1}
+            };
+
+            data += len;
+            bytes -= len;
+        }
+
+        sendmmsg(sock, msg, n, MSG_CONFIRM); // not sent datagrams are lost like any other
+    }
+#else
+    while(bytes > 0){
+        vm_size_t len = bytes < chunk ? bytes : chunk;
+        sendto(sock, data, len, MSG_CONFIRM, (const struct sockaddr*)&adr, sizeof(adr));
+
+        data += len;
+        bytes -= len;
+    }
+#endif
+}
+
+// wait until count elements are received, they are pushed as they come
+void _vmNetRecvStack(const vm_uint32_t* count, vm_uint8_t* stack, vm_size_t* se, vm_size_t capacity, vm_size_t size, vm_size_t thread, VMInstance* vm){
+    VMThread* _thread = &vm->thread[thread];
+
+    if(_thread->wait == false){
+        vm_size_t _count = vm_ui32_to_size_t(*count);
+
+        if(*se + _count > capacity){
+            vm->halt = true;
+            return;
+        }
+
+        _thread->nrecv = _count;
+        _thread->wait = true;
+    }
+
+    vm_size_t chunk = VM_NET_PAYLOAD / size * size;
+
+    while(_thread->nrecv > 0){
+        vm_uint8_t* data = stack + *se * size;
+        vm_uint8_t* end = data;
+        vm_size_t bytes = _thread->nrecv * size;
+
+#ifdef VM_HAS_MMSG
+        struct mmsghdr msg[VM_NET_BURST];
+        struct iovec iov[VM_NET_BURST];
+        unsigned int n = 0;
+
+        for(vm_uint8_t* at = data; n < VM_NET_BURST && bytes > 0; n++){
+            vm_size_t len = bytes < chunk ? bytes : chunk;
+
+            iov[n] = (struct iovec){.iov_base = at, .iov_len = len};
+            msg[n] = (struct mmsghdr){.msg_hdr = {.msg_iov = iov + n, .msg_iovlen = 1}};
+
+            at += len;
+            bytes -= len;
+        }
+
+        int got = recvmmsg(_vmSocket(thread, vm), msg, n, MSG_DONTWAIT, NULL);
+        if(got <= 0) break;
+
+        // datagrams land back to back, only a short one leaves a gap to close
+        for(int i = 0; i < got; i++){
+            vm_size_t len = msg[i].msg_len / size * size;
+
+            if(end != iov[i].iov_base) memmove(end, iov[i].iov_base, len);
+            end += len;
+        }
+#else
+        ssize_t got = recv(_vmSocket(thread, vm), data, bytes < chunk ? bytes : chunk, MSG_DONTWAIT);
+        if(got < 0) break;
+
+        end += got / size * size;
+#endif
+
+        vm_size_t received = (end - data) / size;
+
+        _vm_nums_swap(data, received, size);
+        *se += received;
+        _thread->nrecv -= received;
+    }
+
+    if(_thread->nrecv == 0) _thread->wait = false;
+}
+
+void _vm_send8(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send8 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack8, &vm->se8, sizeof(*vm->stack8), thread, vm);
+}
+void _vm_send16(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send16 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack16, &vm->se16, sizeof(*vm->stack16), thread, vm);
+}
+void _vm_send32(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send32 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack32, &vm->se32, sizeof(*vm->stack32), thread, vm);
+}
+void _vm_send64(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send64 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack64, &vm->se64, sizeof(*vm->stack64), thread, vm);
+}
+void _vm_send128(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send128 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack128, &vm->se128, sizeof(*vm->stack128), thread, vm);
+}
+void _vm_send256(const vm_uint64_t* nadr, const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // send256 {adr}, num32
+    _vmNetSendStack(nadr, count, (vm_uint8_t*)vm->stack256, &vm->se256, sizeof(*vm->stack256), thread, vm);
+}
+
+void _vm_recv8(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv8 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack8, &vm->se8, vm->sc8, sizeof(*vm->stack8), thread, vm);
+}
+void _vm_recv16(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv16 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack16, &vm->se16, vm->sc16, sizeof(*vm->stack16), thread, vm);
+}
+void _vm_recv32(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv32 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack32, &vm->se32, vm->sc32, sizeof(*vm->stack32), thread, vm);
+}
+void _vm_recv64(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv64 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack64, &vm->se64, vm->sc64, sizeof(*vm->stack64), thread, vm);
+}
+void _vm_recv128(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv128 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack128, &vm->se128, vm->sc128, sizeof(*vm->stack128), thread, vm);
+}
+void _vm_recv256(const vm_uint32_t* count, vm_size_t thread, VMInstance* vm){
+    // recv256 num32
+    _vmNetRecvStack(count, (vm_uint8_t*)vm->stack256, &vm->se256, vm->sc256, sizeof(*vm->stack256), thread, vm);
+}
+
+// copy between registers of a thread and instance registers shared by all threads,
+// both are the same registers without VM_THREAD_REGISTERS
+void _vmMoveShared(vm_uint8_t reg0, vm_uint8_t reg1, const vm_uint8_t* from, vm_uint8_t* to, VMInstance* vm){
+    vm_size_t size, start;
+
+    if(VM_R8_INDEX_INBOUNDS(reg0) && VM_R8_INDEX_INBOUNDS(reg1)) size = 1, start = VM_R8_START;
+    else if(VM_R16_INDEX_INBOUNDS(reg0) && VM_R16_INDEX_INBOUNDS(reg1)) size = 2, start = VM_R16_START;
+    else if(VM_R32_INDEX_INBOUNDS(reg0) && VM_R32_INDEX_INBOUNDS(reg1)) size = 4, start = VM_R32_START;
+    else if(VM_R64_INDEX_INBOUNDS(reg0) && VM_R64_INDEX_INBOUNDS(reg1)) size = 8, start = VM_R64_START;
+    else if(VM_R128_INDEX_INBOUNDS(reg0) && VM_R128_INDEX_INBOUNDS(reg1)) size = 16, start = VM_R128_START;
+    else if(VM_R256_INDEX_INBOUNDS(reg0) && VM_R256_INDEX_INBOUNDS(reg1)) size = 32, start = VM_R256_START;
+    else{
+        vm->halt = true;
+        return;
+    }
+
+    memmove(to + VM_REG_OFFSET(reg1 - start, size), from + VM_REG_OFFSET(reg0 - start, size), size);
+}
+void _vm_lds(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t thread, VMInstance* vm){
+    // lds shared_r, r
+    _vmMoveShared(*reg0, *reg1, (const vm_uint8_t*)&vm->r0, (vm_uint8_t*)&VM_BANK(thread, vm).r0, vm);
+}
+void _vm_sts(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t thread, VMInstance* vm){
+    // sts r, shared_r
+    _vmMoveShared(*reg0, *reg1, (const vm_uint8_t*)&VM_BANK(thread, vm).r0, (vm_uint8_t*)&vm->r0, vm);
+}
+
+void _vm_snd_r_r(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t thread, VMInstance* vm){
+    // snd from_r, to_r
+    vm_uint8_t _reg0 = *reg0;
+    vm_uint8_t _reg1 = *reg1;
+
+    if(VM_R8_INDEX_INBOUNDS(_reg0) && VM_R8_INDEX_INBOUNDS(_reg1))
+        VM_R8(_reg1 - VM_R8_END, VM_BANK(thread, vm)) = VM_R8(_reg0 - VM_R8_END, VM_BANK(thread, vm));
     else if(VM_R16_INDEX_INBOUNDS(_reg0) && VM_R16_INDEX_INBOUNDS(_reg1))
-        VM_R16(_reg1 - VM_R16_END, *vm) = VM_R16(_reg0 - VM_R16_END, *vm);
+        VM_R16(_reg1 - VM_R16_END, VM_BANK(thread, vm)) = VM_R16(_reg0 - VM_R16_END, VM_BANK(thread, vm));
     else if(VM_R32_INDEX_INBOUNDS(_reg0) && VM_R32_INDEX_INBOUNDS(_reg1))
-        VM_R32(_reg1 - VM_R32_END, *vm) = VM_R32(_reg0 - VM_R32_END, *vm);
+        VM_R32(_reg1 - VM_R32_END, VM_BANK(thread, vm)) = VM_R32(_reg0 - VM_R32_END, VM_BANK(thread, vm));
     else if(VM_R64_INDEX_INBOUNDS(_reg0) && VM_R64_INDEX_INBOUNDS(_reg1))
-        VM_R64(_reg1 - VM_R64_END, *vm) = VM_R64(_reg0 - VM_R64_END, *vm);
+        VM_R64(_reg1 - VM_R64_END, VM_BANK(thread, vm)) = VM_R64(_reg0 - VM_R64_END, VM_BANK(thread, vm));
     else if(VM_R128_INDEX_INBOUNDS(_reg0) && VM_R128_INDEX_INBOUNDS(_reg1))
-        VM_R128(_reg1 - VM_R128_END, *vm) = VM_R128(_reg0 - VM_R128_END, *vm);
+        VM_R128(_reg1 - VM_R128_END, VM_BANK(thread, vm)) = VM_R128(_reg0 - VM_R128_END, VM_BANK(thread, vm));
     else if(VM_R256_INDEX_INBOUNDS(_reg0) && VM_R256_INDEX_INBOUNDS(_reg1))
-        VM_R256(_reg1 - VM_R256_END, *vm) = VM_R256(_reg0 - VM_R256_END, *vm);
+        VM_R256(_reg1 - VM_R256_END, VM_BANK(thread, vm)) = VM_R256(_reg0 - VM_R256_END, VM_BANK(thread, vm));
     else vm->halt = true;
 }
 void _vm_snd_num_r8(const vm_uint8_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -363,7 +1778,7 @@ void _vm_snd_num_r8(const vm_uint8_t* num, const vm_uint8_t* reg, vm_size_t thre
     vm_uint8_t _reg = *reg;
 
     if(VM_R8_INDEX_INBOUNDS(_reg))
-        VM_UINT8_T(VM_R8(*reg - VM_R8_END, *vm)) = *num;
+        VM_UINT8_T(VM_R8(*reg - VM_R8_END, VM_BANK(thread, vm))) = *num;
     else vm->halt = true;
 }
 void _vm_snd_num_r16(const vm_uint16_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -371,7 +1786,7 @@ void _vm_snd_num_r16(const vm_uint16_t* num, const vm_uint8_t* reg, vm_size_t th
     vm_uint8_t _reg = *reg;
 
     if(VM_R16_INDEX_INBOUNDS(_reg))
-        VM_UINT16_T(VM_R16(*reg - VM_R16_END, *vm)) = *num;
+        _vm_reg_from_num(&VM_R16(*reg - VM_R16_END, VM_BANK(thread, vm)), num, sizeof(*num));
     else vm->halt = true;
 }
 void _vm_snd_num_r32(const vm_uint32_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -379,7 +1794,7 @@ void _vm_snd_num_r32(const vm_uint32_t* num, const vm_uint8_t* reg, vm_size_t th
     vm_uint8_t _reg = *reg;
 
     if(VM_R32_INDEX_INBOUNDS(_reg))
-        VM_UINT32_T(VM_R32(*reg - VM_R32_END, *vm)) = *num;
+        _vm_reg_from_num(&VM_R32(*reg - VM_R32_END, VM_BANK(thread, vm)), num, sizeof(*num));
     else vm->halt = true;
 }
 void _vm_snd_num_r64(const vm_uint64_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -387,7 +1802,7 @@ void _vm_snd_num_r64(const vm_uint64_t* num, const vm_uint8_t* reg, vm_size_t th
     vm_uint8_t _reg = *reg;
 
     if(VM_R64_INDEX_INBOUNDS(_reg))
-        VM_UINT64_T(VM_R64(*reg - VM_R64_END, *vm)) = *num;
+        _vm_reg_from_num(&VM_R64(*reg - VM_R64_END, VM_BANK(thread, vm)), num, sizeof(*num));
     else vm->halt = true;
 }
 void _vm_snd_num_r128(const vm_uint128_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -395,7 +1810,7 @@ void _vm_snd_num_r128(const vm_uint128_t* num, const vm_uint8_t* reg, vm_size_t
     vm_uint8_t _reg = *reg;
 
     if(VM_R128_INDEX_INBOUNDS(_reg))
-        VM_UINT128_T(VM_R128(*reg - VM_R128_END, *vm)) = *num;
+        _vm_reg_from_num(&VM_R128(*reg - VM_R128_END, VM_BANK(thread, vm)), num, sizeof(*num));
     else vm->halt = true;
 }
 void _vm_snd_num_r256(const vm_uint256_t* num, const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -403,39 +1818,33 @@ void _vm_snd_num_r256(const vm_uint256_t* num, const vm_uint8_t* reg, vm_size_t
     vm_uint8_t _reg = *reg;
 
     if(VM_R256_INDEX_INBOUNDS(_reg))
-        VM_UINT256_T(VM_R256(*reg - VM_R256_END, *vm)) = *num;
+        _vm_reg_from_num(&VM_R256(*reg - VM_R256_END, VM_BANK(thread, vm)), num, sizeof(*num));
     else vm->halt = true;
 }
 
 void _vm_push8_num(const vm_uint8_t* num, vm_size_t thread, VMInstance* vm){
     // push8 num
-    vm->stack8[vm_ui256_to_size_t(vm->se8)] = *num;
-    vm->se8 = vm_inc_ui256(vm->se8);
+    vm->stack8[vm->se8++] = *num;
 }
 void _vm_push16_num(const vm_uint16_t* num, vm_size_t thread, VMInstance* vm){
     // push16 num
-    vm->stack16[vm_ui256_to_size_t(vm->se16)] = *num;
-    vm->se16 = vm_inc_ui256(vm->se16);
+    _vm_reg_from_num(vm->stack16 + vm->se16++, num, sizeof(*num));
 }
 void _vm_push32_num(const vm_uint32_t* num, vm_size_t thread, VMInstance* vm){
     // push32 num
-    vm->stack32[vm_ui256_to_size_t(vm->se32)] = *num;
-    vm->se32 = vm_inc_ui256(vm->se32);
+    _vm_reg_from_num(vm->stack32 + vm->se32++, num, sizeof(*num));
 }
 void _vm_push64_num(const vm_uint64_t* num, vm_size_t thread, VMInstance* vm){
     // push64 num
-    vm->stack64[vm_ui256_to_size_t(vm->se64)] = *num;
-    vm->se64 = vm_inc_ui256(vm->se64);
+    _vm_reg_from_num(vm->stack64 + vm->se64++, num, sizeof(*num));
 }
 void _vm_push128_num(const vm_uint128_t* num, vm_size_t thread, VMInstance* vm){
     // push128 num
-    vm->stack128[vm_ui256_to_size_t(vm->se128)] = *num;
-    vm->se128 = vm_inc_ui256(vm->se128);
+    _vm_reg_from_num(vm->stack128 + vm->se128++, num, sizeof(*num));
 }
 void _vm_push256_num(const vm_uint256_t* num, vm_size_t thread, VMInstance* vm){
     // push256 num
-    vm->stack256[vm_ui256_to_size_t(vm->se256)] = *num;
-    vm->se256 = vm_inc_ui256(vm->se256);
+    _vm_reg_from_num(vm->stack256 + vm->se256++, num, sizeof(*num));
 }
 
 void _vm_push8_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -443,8 +1852,7 @@ void _vm_push8_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R8_INDEX_INBOUNDS(_reg)){
-        vm->stack8[vm_ui256_to_size_t(vm->se8)] = VM_UINT8_T(VM_R8(*reg - VM_R8_END, *vm));
-        vm->se8 = vm_inc_ui256(vm->se8);
+        vm->stack8[vm->se8++] = VM_UINT8_T(VM_R8(*reg - VM_R8_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 void _vm_push16_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -452,8 +1860,7 @@ void _vm_push16_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R16_INDEX_INBOUNDS(_reg)){
-        vm->stack16[vm_ui256_to_size_t(vm->se16)] = VM_UINT16_T(VM_R16(*reg - VM_R16_END, *vm));
-        vm->se16 = vm_inc_ui256(vm->se16);
+        vm->stack16[vm->se16++] = VM_UINT16_T(VM_R16(*reg - VM_R16_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 void _vm_push32_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -461,8 +1868,7 @@ void _vm_push32_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R32_INDEX_INBOUNDS(_reg)){
-        vm->stack32[vm_ui256_to_size_t(vm->se32)] = VM_UINT32_T(VM_R32(*reg - VM_R32_END, *vm));
-        vm->se32 = vm_inc_ui256(vm->se32);
+        vm->stack32[vm->se32++] = VM_UINT32_T(VM_R32(*reg - VM_R32_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 void _vm_push64_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -470,8 +1876,7 @@ void _vm_push64_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R64_INDEX_INBOUNDS(_reg)){
-        vm->stack64[vm_ui256_to_size_t(vm->se64)] = VM_UINT64_T(VM_R64(*reg - VM_R64_END, *vm));
-        vm->se64 = vm_inc_ui256(vm->se64);
+        vm->stack64[vm->se64++] = VM_UINT64_T(VM_R64(*reg - VM_R64_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 void _vm_push128_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -479,8 +1884,7 @@ void _vm_push128_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R128_INDEX_INBOUNDS(_reg)){
-        vm->stack128[vm_ui256_to_size_t(vm->se128)] = VM_UINT128_T(VM_R128(*reg - VM_R128_END, *vm));
-        vm->se128 = vm_inc_ui256(vm->se128);
+        vm->stack128[vm->se128++] = VM_UINT128_T(VM_R128(*reg - VM_R128_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 void _vm_push256_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -488,8 +1892,7 @@ void _vm_push256_r(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R256_INDEX_INBOUNDS(_reg)){
-        vm->stack256[vm_ui256_to_size_t(vm->se256)] = VM_UINT256_T(VM_R256(*reg - VM_R256_END, *vm));
-        vm->se256 = vm_inc_ui256(vm->se256);
+        vm->stack256[vm->se256++] = VM_UINT256_T(VM_R256(*reg - VM_R256_END, VM_BANK(thread, vm)));
     }else vm->halt = true;
 }
 
@@ -498,8 +1901,7 @@ void _vm_pop8(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R8_INDEX_INBOUNDS(_reg)){
-        vm->se8 = vm_dec_ui256(vm->se8);
-        VM_UINT8_T(VM_R8(*reg - VM_R8_END, *vm)) = vm->stack8[vm_ui256_to_size_t(vm->se8)];
+        VM_UINT8_T(VM_R8(*reg - VM_R8_END, VM_BANK(thread, vm))) = vm->stack8[--vm->se8];
     }else vm->halt = true;
 }
 void _vm_pop16(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -507,8 +1909,7 @@ void _vm_pop16(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R16_INDEX_INBOUNDS(_reg)){
-        vm->se16 = vm_dec_ui256(vm->se16);
-        VM_UINT16_T(VM_R16(*reg - VM_R16_END, *vm)) = vm->stack16[vm_ui256_to_size_t(vm->se16)];
+        VM_UINT16_T(VM_R16(*reg - VM_R16_END, VM_BANK(thread, vm))) = vm->stack16[--vm->se16];
     }else vm->halt = true;
 }
 void _vm_pop32(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -516,8 +1917,7 @@ void _vm_pop32(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R32_INDEX_INBOUNDS(_reg)){
-        vm->se32 = vm_dec_ui256(vm->se32);
-        VM_UINT32_T(VM_R32(*reg - VM_R32_END, *vm)) = vm->stack32[vm_ui256_to_size_t(vm->se32)];
+        VM_UINT32_T(VM_R32(*reg - VM_R32_END, VM_BANK(thread, vm))) = vm->stack32[--vm->se32];
     }else vm->halt = true;
 }
 void _vm_pop64(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -525,8 +1925,7 @@ void _vm_pop64(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R64_INDEX_INBOUNDS(_reg)){
-        vm->se64 = vm_dec_ui256(vm->se64);
-        VM_UINT64_T(VM_R64(*reg - VM_R64_END, *vm)) = vm->stack64[vm_ui256_to_size_t(vm->se64)];
+        VM_UINT64_T(VM_R64(*reg - VM_R64_END, VM_BANK(thread, vm))) = vm->stack64[--vm->se64];
     }else vm->halt = true;
 }
 void _vm_pop128(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -534,8 +1933,7 @@ void _vm_pop128(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R128_INDEX_INBOUNDS(_reg)){
-        vm->se128 = vm_dec_ui256(vm->se128);
-        VM_UINT128_T(VM_R128(*reg - VM_R128_END, *vm)) = vm->stack128[vm_ui256_to_size_t(vm->se128)];
+        VM_UINT128_T(VM_R128(*reg - VM_R128_END, VM_BANK(thread, vm))) = vm->stack128[--vm->se128];
     }else vm->halt = true;
 }
 void _vm_pop256(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
@@ -543,8 +1941,7 @@ void _vm_pop256(const vm_uint8_t* reg, vm_size_t thread, VMInstance* vm){
     vm_uint8_t _reg = *reg;
 
     if(VM_R256_INDEX_INBOUNDS(_reg)){
-        vm->se256 = vm_dec_ui256(vm->se256);
-        VM_UINT256_T(VM_R256(*reg - VM_R256_END, *vm)) = vm->stack256[vm_ui256_to_size_t(vm->se256)];
+        VM_UINT256_T(VM_R256(*reg - VM_R256_END, VM_BANK(thread, vm))) = vm->stack256[--vm->se256];
     }else vm->halt = true;
 }
 
@@ -554,17 +1951,17 @@ void _vm_inc_r_r(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t threa
     vm_uint8_t _reg1 = *reg1;
 
     if(VM_R8_INDEX_INBOUNDS(_reg0) && VM_R8_INDEX_INBOUNDS(_reg1))
-        VM_UINT8_T(VM_R8(_reg1 - VM_R8_END, *vm)) = VM_UINT8_T(VM_R8(_reg0 - VM_R8_END, *vm)) + 1;
+        VM_UINT8_T(VM_R8(_reg1 - VM_R8_END, VM_BANK(thread, vm))) = VM_UINT8_T(VM_R8(_reg0 - VM_R8_END, VM_BANK(thread, vm))) + 1;
     else if(VM_R16_INDEX_INBOUNDS(_reg0) && VM_R16_INDEX_INBOUNDS(_reg1))
-        VM_UINT16_T(VM_R16(_reg1 - VM_R16_END, *vm)) = vm_inc_ui16(VM_UINT16_T(VM_R16(_reg0 - VM_R16_END, *vm)));
+        _vm_reg_inc16(&VM_R16(_reg1 - VM_R16_END, VM_BANK(thread, vm)), &VM_R16(_reg0 - VM_R16_END, VM_BANK(thread, vm)));
     else if(VM_R32_INDEX_INBOUNDS(_reg0) && VM_R32_INDEX_INBOUNDS(_reg1))
-        VM_UINT32_T(VM_R32(_reg1 - VM_R32_END, *vm)) = vm_inc_ui32(VM_UINT32_T(VM_R32(_reg0 - VM_R32_END, *vm)));
+        _vm_reg_inc32(&VM_R32(_reg1 - VM_R32_END, VM_BANK(thread, vm)), &VM_R32(_reg0 - VM_R32_END, VM_BANK(thread, vm)));
     else if(VM_R64_INDEX_INBOUNDS(_reg0) && VM_R64_INDEX_INBOUNDS(_reg1))
-        VM_UINT64_T(VM_R64(_reg1 - VM_R64_END, *vm)) = vm_inc_ui64(VM_UINT64_T(VM_R64(_reg0 - VM_R64_END, *vm)));
+        _vm_reg_inc64(&VM_R64(_reg1 - VM_R64_END, VM_BANK(thread, vm)), &VM_R64(_reg0 - VM_R64_END, VM_BANK(thread, vm)));
     else if(VM_R128_INDEX_INBOUNDS(_reg0) && VM_R128_INDEX_INBOUNDS(_reg1))
-        VM_UINT128_T(VM_R128(_reg1 - VM_R128_END, *vm)) = vm_inc_ui128(VM_UINT128_T(VM_R128(_reg0 - VM_R128_END, *vm)));
+        _vm_reg_inc128(&VM_R128(_reg1 - VM_R128_END, VM_BANK(thread, vm)), &VM_R128(_reg0 - VM_R128_END, VM_BANK(thread, vm)));
     else if(VM_R256_INDEX_INBOUNDS(_reg0) && VM_R256_INDEX_INBOUNDS(_reg1))
-        VM_UINT256_T(VM_R256(_reg1 - VM_R256_END, *vm)) = vm_inc_ui256(VM_UINT256_T(VM_R256(_reg0 - VM_R256_END, *vm)));
+        _vm_reg_inc256(&VM_R256(_reg1 - VM_R256_END, VM_BANK(thread, vm)), &VM_R256(_reg0 - VM_R256_END, VM_BANK(thread, vm)));
     else vm->halt = true;
 }
 void _vm_dec_r_r(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t thread, VMInstance* vm){
@@ -573,35 +1970,173 @@ void _vm_dec_r_r(const vm_uint8_t* reg0, const vm_uint8_t* reg1, vm_size_t threa
     vm_uint8_t _reg1 = *reg1;
 
     if(VM_R8_INDEX_INBOUNDS(_reg0) && VM_R8_INDEX_INBOUNDS(_reg1))
-        VM_UINT8_T(VM_R8(_reg1 - VM_R8_END, *vm)) = VM_UINT8_T(VM_R8(_reg0 - VM_R8_END, *vm)) - 1;
+        VM_UINT8_T(VM_R8(_reg1 - VM_R8_END, VM_BANK(thread, vm))) = VM_UINT8_T(VM_R8(_reg0 - VM_R8_END, VM_BANK(thread, vm))) - 1;
     else if(VM_R16_INDEX_INBOUNDS(_reg0) && VM_R16_INDEX_INBOUNDS(_reg1))
-        VM_UINT16_T(VM_R16(_reg1 - VM_R16_END, *vm)) = vm_dec_ui16(VM_UINT16_T(VM_R16(_reg0 - VM_R16_END, *vm)));
+        _vm_reg_dec16(&VM_R16(_reg1 - VM_R16_END, VM_BANK(thread, vm)), &VM_R16(_reg0 - VM_R16_END, VM_BANK(thread, vm)));
     else if(VM_R32_INDEX_INBOUNDS(_reg0) && VM_R32_INDEX_INBOUNDS(_reg1))
-        VM_UINT32_T(VM_R32(_reg1 - VM_R32_END, *vm)) = vm_dec_ui32(VM_UINT32_T(VM_R32(_reg0 - VM_R32_END, *vm)));
+        _vm_reg_dec32(&VM_R32(_reg1 - VM_R32_END, VM_BANK(thread, vm)), &VM_R32(_reg0 - VM_R32_END, VM_BANK(thread, vm)));
     else if(VM_R64_INDEX_INBOUNDS(_reg0) && VM_R64_INDEX_INBOUNDS(_reg1))
-        VM_UINT64_T(VM_R64(_reg1 - VM_R64_END, *vm)) = vm_dec_ui64(VM_UINT64_T(VM_R64(_reg0 - VM_R64_END, *vm)));
+        _vm_reg_dec64(&VM_R64(_reg1 - VM_R64_END, VM_BANK(thread, vm)), &VM_R64(_reg0 - VM_R64_END, VM_BANK(thread, vm)));
     else if(VM_R128_INDEX_INBOUNDS(_reg0) && VM_R128_INDEX_INBOUNDS(_reg1))
-        VM_UINT128_T(VM_R128(_reg1 - VM_R128_END, *vm)) = vm_dec_ui128(VM_UINT128_T(VM_R128(_reg0 - VM_R128_END, *vm)));
+        _vm_reg_dec128(&VM_R128(_reg1 - VM_R128_END, VM_BANK(thread, vm)), &VM_R128(_reg0 - VM_R128_END, VM_BANK(thread, vm)));
     else if(VM_R256_INDEX_INBOUNDS(_reg0) && VM_R256_INDEX_INBOUNDS(_reg1))
-        VM_UINT256_T(VM_R256(_reg1 - VM_R256_END, *vm)) = vm_dec_ui256(VM_UINT256_T(VM_R256(_reg0 - VM_R256_END, *vm)));
+        _vm_reg_dec256(&VM_R256(_reg1 - VM_R256_END, VM_BANK(thread, vm)), &VM_R256(_reg0 - VM_R256_END, VM_BANK(thread, vm)));
     else vm->halt = true;
 }
 
 void _vm_lock(vm_size_t thread, VMInstance* vm){
+    if(vm->sync != NULL) vm->sync->lock(vm, thread); // wait until other threads stop
+#ifdef VM_STATS
+    _vmStatsLocked(vm, thread, true);
+#endif
+#ifdef VM_TRACE
+    _vmTrace(vm->trace, thread, vm->thread[thread].pc, NULL, VM_TRACE_LOCK);
+#endif
+
     for(vm_size_t i = 0; i < vm->threads_count; i++){
         if(i != thread) vm->thread[i].lock = true;
     }
+    vm->sched.epoch++;
 }
 void _vm_unlock(vm_size_t thread, VMInstance* vm){
+#ifdef VM_STATS
+    _vmStatsLocked(vm, thread, false);
+#endif
+#ifdef VM_TRACE
+    _vmTrace(vm->trace, thread, vm->thread[thread].pc, NULL, VM_TRACE_UNLOCK);
+#endif
     for(vm_size_t i = 0; i < vm->threads_count; i++){
         if(i != thread) vm->thread[i].lock = false;
     }
+    vm->sched.epoch++;
+
+    if(vm->sync != NULL) vm->sync->unlock(vm, thread);
+}
+
+
+// unchecked handlers, operands are checked and decoded once by vmVerifyProgram
+#define VM_DECODED_IMPL(impl) (((void(*)(const VMProgram*, const VMInstruction*, vm_size_t, VMInstance*))(impl)))
+
+// decoded register operand
+#define VM_DREG(type, offset, thread, vm) (*(type*)((vm_uint8_t*)&VM_BANK(thread, vm).r0 + (offset)))
+
+// decoded number, wider ones are in pool of the program
+const void* _vmImmediate(const VMProgram* prog, const VMInstruction* instr, vm_size_t size){
+    return size <= sizeof(instr->imm) ? (const void*)&instr->imm : prog->pool + instr->pool;
+}
+
+void _vm_go_r256(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){
+    // go r256
+    vm->thread[thread].pc = _vm_r256_to_size_t(&VM_DREG(vm_r256, instr->r0, thread, vm));
+}
+void _vm_go_pc(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){
+    // go adr
+    vm->thread[thread].pc = instr->imm;
+}
+void _vm_ask_adr(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){
+    // ask {adr}, address is built once
+    _vmAsk((const struct sockaddr_in*)(prog->pool + instr->pool), thread, vm);
+}
+
+#define _vm_unchecked_handlers(bitdepth)\
+void _vm_snd_r##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    VM_DREG(vm_r##bitdepth, instr->r1, thread, vm) = VM_DREG(vm_r##bitdepth, instr->r0, thread, vm);\
+}\
+void _vm_snd_num##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    memcpy(&VM_DREG(vm_r##bitdepth, instr->r1, thread, vm), _vmImmediate(prog, instr, bitdepth / 8), bitdepth / 8);\
+}\
+void _vm_push##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    memcpy(vm->stack##bitdepth + vm->se##bitdepth++, &VM_DREG(vm_r##bitdepth, instr->r0, thread, vm), sizeof(*vm->stack##bitdepth));\
+}\
+void _vm_pop##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    memcpy(&VM_DREG(vm_r##bitdepth, instr->r0, thread, vm), vm->stack##bitdepth + --vm->se##bitdepth, sizeof(*vm->stack##bitdepth));\
+}\
+void _vm_inc_r##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    _vm_reg_inc##bitdepth(&VM_DREG(vm_r##bitdepth, instr->r1, thread, vm), &VM_DREG(vm_r##bitdepth, instr->r0, thread, vm));\
+}\
+void _vm_dec_r##bitdepth##_r##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    _vm_reg_dec##bitdepth(&VM_DREG(vm_r##bitdepth, instr->r1, thread, vm), &VM_DREG(vm_r##bitdepth, instr->r0, thread, vm));\
+}\
+void _vm_push##bitdepth##_imm(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    memcpy(vm->stack##bitdepth + vm->se##bitdepth++, _vmImmediate(prog, instr, bitdepth / 8), bitdepth / 8);\
+}
+
+_vm_unchecked_handlers(8)
+_vm_unchecked_handlers(16)
+_vm_unchecked_handlers(32)
+_vm_unchecked_handlers(64)
+_vm_unchecked_handlers(128)
+_vm_unchecked_handlers(256)
+
+// superinstructions, vmFuseProgram leaves the instructions they cover in place
+#define _vm_fused_handlers(bitdepth)\
+void _vm_snd_inc##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    /* snd num, a; inc a, b */\
+    memcpy(&VM_DREG(vm_r##bitdepth, instr->r1, thread, vm), _vmImmediate(prog, instr, bitdepth / 8), bitdepth / 8);\
+    _vm_reg_inc##bitdepth(&VM_DREG(vm_r##bitdepth, instr->r0, thread, vm), &VM_DREG(vm_r##bitdepth, instr->r1, thread, vm));\
+}\
+void _vm_push_pop##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    /* push a; pop b, the slot is written as push does */\
+    memcpy(vm->stack##bitdepth + vm->se##bitdepth, &VM_DREG(vm_r##bitdepth, instr->r0, thread, vm), sizeof(*vm->stack##bitdepth));\
+    memcpy(&VM_DREG(vm_r##bitdepth, instr->r1, thread, vm), vm->stack##bitdepth + vm->se##bitdepth, sizeof(*vm->stack##bitdepth));\
+}\
+void _vm_pop_push##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    /* pop a; push a */\
+    memcpy(&VM_DREG(vm_r##bitdepth, instr->r0, thread, vm), vm->stack##bitdepth + vm->se##bitdepth - 1, sizeof(*vm->stack##bitdepth));\
+}\
+void _vm_inc_run##bitdepth(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){\
+    /* imm times inc a, a */\
+    vm_r##bitdepth* reg = &VM_DREG(vm_r##bitdepth, instr->r0, thread, vm);\
+    for(uint32_t i = 0; i < instr->imm; i++) _vm_reg_inc##bitdepth(reg, reg);\
+}
+
+_vm_fused_handlers(8)
+_vm_fused_handlers(16)
+_vm_fused_handlers(32)
+_vm_fused_handlers(64)
+_vm_fused_handlers(128)
+_vm_fused_handlers(256)
+
+#define _VM_LOCKED_CASES(bitdepth)\
+    case VM_OP_SND_R##bitdepth##_R##bitdepth: _vm_snd_r##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_SND_NUM##bitdepth##_R##bitdepth: _vm_snd_num##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_PUSH##bitdepth##_R##bitdepth: _vm_push##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_POP##bitdepth##_R##bitdepth: _vm_pop##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_INC_R##bitdepth##_R##bitdepth: _vm_inc_r##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_DEC_R##bitdepth##_R##bitdepth: _vm_dec_r##bitdepth##_r##bitdepth(prog, body, thread, vm); break;\
+    case VM_OP_PUSH##bitdepth##_IMM: _vm_push##bitdepth##_imm(prog, body, thread, vm); break;
+
+void _vm_locked(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm){
+    // lock; imm - 2 register and stack instructions; unlock
+    _vm_lock(thread, vm);
+
+    for(const VMInstruction* body = instr + 1; body < instr + instr->imm - 1; body++){
+        switch(body->op){
+        _VM_LOCKED_CASES(8)
+        _VM_LOCKED_CASES(16)
+        _VM_LOCKED_CASES(32)
+        _VM_LOCKED_CASES(64)
+        _VM_LOCKED_CASES(128)
+        _VM_LOCKED_CASES(256)
+        default:
+            break;
+        }
+    }
+
+    _vm_unlock(thread, vm);
+}
+
+// count of instructions run by one
+vm_size_t _vmFusedLength(const VMInstruction* instr){
+    if(instr->op < VM_OP_SND_INC8) return 1;
+    if(instr->op < VM_OP_INC_RUN8) return 2;
+    return instr->imm; // inc runs and locked sections
 }
 
 /////////////////////////////////////////////////////
 //       GLOBAL INSTRUCTION DESCRIPTORS TABLE
 /////////////////////////////////////////////////////
-VMInstructionDescriptor _GIDT[33] = {
+VMInstructionDescriptor _GIDT[49] = {
     (VMInstructionDescriptor){
         .itype = SINGLE,
         .op0_type = CODE_ADDRESS,
@@ -859,167 +2394,3272 @@ VMInstructionDescriptor _GIDT[33] = {
         .icode = {0x00, 0x00, 0x00, 0x1f},
         .alias = "unlock",
         .impl = _vm_unlock
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = REGISTER,
+        .op0_size = UINT64_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x22},
+        .alias = "send",
+        .impl = _vm_send_r
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x23},
+        .alias = "recv",
+        .impl = _vm_recv_r
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x24},
+        .alias = "send8",
+        .impl = _vm_send8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x25},
+        .alias = "send16",
+        .impl = _vm_send16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x26},
+        .alias = "send32",
+        .impl = _vm_send32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x27},
+        .alias = "send64",
+        .impl = _vm_send64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x28},
+        .alias = "send128",
+        .impl = _vm_send128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NETWORK_ADDRESS, .op1_type = NUMBER,
+        .op0_size = UINT64_T, .op1_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x29},
+        .alias = "send256",
+        .impl = _vm_send256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2a},
+        .alias = "recv8",
+        .impl = _vm_recv8
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2b},
+        .alias = "recv16",
+        .impl = _vm_recv16
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2c},
+        .alias = "recv32",
+        .impl = _vm_recv32
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2d},
+        .alias = "recv64",
+        .impl = _vm_recv64
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2e},
+        .alias = "recv128",
+        .impl = _vm_recv128
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x2f},
+        .alias = "recv256",
+        .impl = _vm_recv256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x30},
+        .alias = "lds",
+        .impl = _vm_lds
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x31},
+        .alias = "sts",
+        .impl = _vm_sts
     }
 };
 
 VMInstructionDescriptorsTable GIDT = {
     .idt = _GIDT,
-    .size = 33
+    .size = 49
 };
 
-
-/////////////////////////////////////////
-//               METHODS
-/////////////////////////////////////////
-
-const VMInstructionDescriptor* _vmFindInstructionIDT(const vm_uint32_t* icode, const VMInstructionDescriptorsTable* idt){
-    vm_size_t size = idt->size;
-
-    for(vm_size_t i = 0; i < size; i++){
-        if(vm_equal_ui32(*icode, idt->idt[i].icode)) return idt->idt + i;
-    }    
-    return NULL;
-}
-const VMInstructionDescriptor* vmFindInstruction(const vm_uint32_t* icode, const VMInstructionDescriptorsExt* ext){
-    const VMInstructionDescriptor* desc = _vmFindInstructionIDT(icode, &GIDT);
-    if(desc != NULL) return desc;
-
-    if(ext != NULL){
-        for(vm_size_t i = 0; i < ext->size; i++){
-            desc = _vmFindInstructionIDT(icode, ext->ext[i]);
-            if(desc != NULL) return desc;
-        }
-    }
-
-    return NULL;
-}
-
-void vmExecInstruction(const VMInstruction* instr, vm_size_t thread, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
-    if(vm->halt == false){
-        const VMInstructionDescriptor* desc = vmFindInstruction(instr->icode, ext);
-
-        if(desc != NULL){
-            switch (desc->itype){
-            case FREE:
-                VM_FREE_IMPL(desc->impl)(thread, vm);
-                break;
-            case SINGLE:
-                VM_SINGLE_IMPL(desc->impl)(instr->op0, thread, vm);
-                break;
-            case DOUBLE:
-                VM_DOUBLE_IMPL(desc->impl)(instr->op0, instr->op1, thread, vm);
-                break;
-            case TRIPLE:
-                VM_TRIPLE_IMPL(desc->impl)(instr->op0, instr->op1, instr->op2, thread, vm);
-                break;
-            default:
-                break;
-            }
-        }
-    }else ; // do some exception here
-}
-
-
-void vmExecProgram(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
-    // init threads
-    for(vm_size_t i = 0; i < exec_count; i++){
-        VMThread* thread = &vm->thread[exec[i].thread];
-
-        if(exec[i].thread < vm->threads_count){
-            if(thread->lock == false){
-                VM_UINT256_T(thread->pc) = (vm_uint256_t){
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00,
-                    0x00, 0x00, 0x00, 0x00
-                };
-            }
-        }else{
-            vm->halt = true;
-            return;
-        }
-    }
-
-    // execute program
-    vm_bool stop = false;
-
-    while(!stop){
-        stop = true;
-        for(vm_size_t i = 0; i < exec_count; i++){
-            VMThread* thread = &vm->thread[exec[i].thread];
-
-            if(thread->lock == false){
-                if(vm_ui256_to_size_t(thread->pc) < exec[i].prog->size){
-                    if(vm->halt) return;
-                    vmExecInstruction(exec[i].prog->program + vm_ui256_to_size_t(thread->pc), exec[i].thread, vm, ext);
-
-                    if(thread->wait == false)
-                        VM_UINT256_T(thread->pc) = vm_inc_ui256(VM_UINT256_T(thread->pc));
-                    stop = false;
-                }
-            }
-        }
-    }
-}
-
-
-
-VMParser vmParseInstruction(const vm_uint8_t* bytecode, const VMInstructionDescriptorsExt* ext){
-    VMParser result = {
-        .instr = {.icode = NULL},
-        .next = bytecode
-    };
-
-    const VMInstructionDescriptor* desc = vmFindInstruction((vm_uint32_t*)bytecode, ext);
-
-    if(desc != NULL){
-        result.instr.icode = (vm_uint32_t*)bytecode;
-
-        switch (desc->itype){
-        case FREE:
-            result.next = bytecode + sizeof(vm_uint32_t);
-            return result;
-            break;
+// unchecked forms of base instructions and superinstructions, never found by icode
+VMInstructionDescriptor _FIDT[70] = {
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x02},
+        .alias = "go",
+        .impl = _vm_go_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x03},
+        .alias = "snd",
+        .impl = _vm_snd_r256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x04},
+        .alias = "snd",
+        .impl = _vm_snd_num8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT16_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x05},
+        .alias = "snd",
+        .impl = _vm_snd_num16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT32_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x06},
+        .alias = "snd",
+        .impl = _vm_snd_num32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT64_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x07},
+        .alias = "snd",
+        .impl = _vm_snd_num64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT128_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x08},
+        .alias = "snd",
+        .impl = _vm_snd_num128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT256_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x09},
+        .alias = "snd",
+        .impl = _vm_snd_num256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x10},
+        .alias = "push8",
+        .impl = _vm_push8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x11},
+        .alias = "push16",
+        .impl = _vm_push16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x12},
+        .alias = "push32",
+        .impl = _vm_push32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x13},
+        .alias = "push64",
+        .impl = _vm_push64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x14},
+        .alias = "push128",
+        .impl = _vm_push128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x15},
+        .alias = "push256",
+        .impl = _vm_push256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x16},
+        .alias = "pop8",
+        .impl = _vm_pop8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x17},
+        .alias = "pop16",
+        .impl = _vm_pop16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x18},
+        .alias = "pop32",
+        .impl = _vm_pop32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x19},
+        .alias = "pop64",
+        .impl = _vm_pop64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1a},
+        .alias = "pop128",
+        .impl = _vm_pop128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1b},
+        .alias = "pop256",
+        .impl = _vm_pop256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc",
+        .impl = _vm_inc_r256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r8_r8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r16_r16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r32_r32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r64_r64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r128_r128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1d},
+        .alias = "dec",
+        .impl = _vm_dec_r256_r256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = CODE_ADDRESS,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x01},
+        .alias = "go",
+        .impl = _vm_go_pc
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x0a},
+        .alias = "push8",
+        .impl = _vm_push8_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT16_T,
+        .icode = {0x00, 0x00, 0x00, 0x0b},
+        .alias = "push16",
+        .impl = _vm_push16_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT32_T,
+        .icode = {0x00, 0x00, 0x00, 0x0c},
+        .alias = "push32",
+        .impl = _vm_push32_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT64_T,
+        .icode = {0x00, 0x00, 0x00, 0x0d},
+        .alias = "push64",
+        .impl = _vm_push64_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT128_T,
+        .icode = {0x00, 0x00, 0x00, 0x0e},
+        .alias = "push128",
+        .impl = _vm_push128_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NUMBER,
+        .op0_size = UINT256_T,
+        .icode = {0x00, 0x00, 0x00, 0x0f},
+        .alias = "push256",
+        .impl = _vm_push256_imm
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = NETWORK_ADDRESS,
+        .op0_size = UINT64_T,
+        .icode = {0x00, 0x00, 0x00, 0x20},
+        .alias = "ask",
+        .impl = _vm_ask_adr
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x04},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT16_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x05},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT32_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x06},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT64_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x07},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT128_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x08},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = NUMBER, .op1_type = REGISTER,
+        .op0_size = UINT256_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x09},
+        .alias = "snd+inc",
+        .impl = _vm_snd_inc256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x10},
+        .alias = "push8+pop8",
+        .impl = _vm_push_pop8
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x11},
+        .alias = "push16+pop16",
+        .impl = _vm_push_pop16
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x12},
+        .alias = "push32+pop32",
+        .impl = _vm_push_pop32
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x13},
+        .alias = "push64+pop64",
+        .impl = _vm_push_pop64
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x14},
+        .alias = "push128+pop128",
+        .impl = _vm_push_pop128
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x15},
+        .alias = "push256+pop256",
+        .impl = _vm_push_pop256
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x16},
+        .alias = "pop8+push8",
+        .impl = _vm_pop_push8
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x17},
+        .alias = "pop16+push16",
+        .impl = _vm_pop_push16
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x18},
+        .alias = "pop32+push32",
+        .impl = _vm_pop_push32
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x19},
+        .alias = "pop64+push64",
+        .impl = _vm_pop_push64
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1a},
+        .alias = "pop128+push128",
+        .impl = _vm_pop_push128
+    },
+    (VMInstructionDescriptor){
+        .itype = SINGLE,
+        .op0_type = REGISTER,
+        .op0_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1b},
+        .alias = "pop256+push256",
+        .impl = _vm_pop_push256
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run8
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run16
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run32
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run64
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run128
+    },
+    (VMInstructionDescriptor){
+        .itype = DOUBLE,
+        .op0_type = REGISTER, .op1_type = REGISTER,
+        .op0_size = UINT8_T, .op1_size = UINT8_T,
+        .icode = {0x00, 0x00, 0x00, 0x1c},
+        .alias = "inc*",
+        .impl = _vm_inc_run256
+    },
+    (VMInstructionDescriptor){
+        .itype = FREE,
+        .icode = {0x00, 0x00, 0x00, 0x1e},
+        .alias = "lock*",
+        .impl = _vm_locked
+    }
+};
+
+VM_OPCODE _vmOpcode(const VMInstructionDescriptor* desc){
+    if(desc >= _GIDT && desc < _GIDT + GIDT.size) return (VM_OPCODE)(desc - _GIDT + 1);
+    if(desc >= _FIDT && desc < _FIDT + sizeof(_FIDT) / sizeof(*_FIDT)) return (VM_OPCODE)(desc - _FIDT + VM_OP_GO_R256);
+    return VM_OP_EXT;
+}
+const VMInstructionDescriptor* _vmOpDescriptor(VM_OPCODE op){
+    return op < VM_OP_GO_R256 ? _GIDT + op - 1 : _FIDT + (op - VM_OP_GO_R256);
+}
+
+
+/////////////////////////////////////////
+//               METHODS
+/////////////////////////////////////////
+
+const VMInstructionDescriptor* _vmFindInstructionIDT(const vm_uint32_t* icode, const VMInstructionDescriptorsTable* idt){
+    vm_size_t size = idt->size;
+
+    for(vm_size_t i = 0; i < size; i++){
+        if(vm_equal_ui32(*icode, idt->idt[i].icode)) return idt->idt + i;
+    }    
+    return NULL;
+}
+const VMInstructionDescriptor* vmFindInstruction(const vm_uint32_t* icode, const VMInstructionDescriptorsExt* ext){
+    const VMInstructionDescriptor* desc = _vmFindInstructionIDT(icode, &GIDT);
+    if(desc != NULL) return desc;
+
+    if(ext != NULL){
+        for(vm_size_t i = 0; i < ext->size; i++){
+            desc = _vmFindInstructionIDT(icode, ext->ext[i]);
+            if(desc != NULL) return desc;
+        }
+    }
+
+    return NULL;
+}
+
+
+// registry
+#define VM_REGISTRY_MIN_CAPACITY 64
+
+vm_size_t _vmRegistryHash(const vm_uint32_t* icode, vm_size_t capacity){
+    unsigned int code = ((unsigned int)icode->bytes[0] << 24) | ((unsigned int)icode->bytes[1] << 16) | ((unsigned int)icode->bytes[2] << 8) | icode->bytes[3];
+    return (vm_size_t)((code * 2654435761u) & (capacity - 1));
+}
+
+void _vmRegistryInsert(VMInstructionRegistry* reg, const VMInstructionDescriptor* desc){
+    vm_size_t i = _vmRegistryHash(&desc->icode, reg->capacity);
+
+    while(reg->slot[i] != NULL) i = (i + 1) & (reg->capacity - 1);
+
+    reg->slot[i] = desc;
+    reg->size++;
+}
+
+void _vmRegistryGrow(VMInstructionRegistry* reg){
+    const VMInstructionDescriptor** old = reg->slot;
+    vm_size_t old_capacity = reg->capacity;
+
+    reg->capacity *= 2;
+    reg->size = 0;
+    reg->slot = calloc(reg->capacity, sizeof(const VMInstructionDescriptor*));
+
+    for(vm_size_t i = 0; i < old_capacity; i++){
+        if(old[i] != NULL) _vmRegistryInsert(reg, old[i]);
+    }
+    free(old);
+}
+
+const VMInstructionDescriptor* vmRegistryFind(const VMInstructionRegistry* reg, const vm_uint32_t* icode){
+    vm_size_t i = _vmRegistryHash(icode, reg->capacity);
+
+    while(reg->slot[i] != NULL){
+        if(vm_equal_ui32(*icode, reg->slot[i]->icode)) return reg->slot[i];
+        i = (i + 1) & (reg->capacity - 1);
+    }
+    return NULL;
+}
+
+vm_bool vmRegisterInstruction(VMInstructionRegistry* reg, const VMInstructionDescriptor* desc){
+    // a second descriptor of an icode isn't registered, the registry is marked as colliding
+    if(vmRegistryFind(reg, &desc->icode) != NULL){
+        reg->collision = true;
+        return false;
+    }
+
+    if(2 * (reg->size + 1) > reg->capacity) _vmRegistryGrow(reg);
+    _vmRegistryInsert(reg, desc);
+
+    return true;
+}
+
+VMInstructionRegistry vmInstructionRegistry(const VMInstructionDescriptorsExt* ext){
+    VMInstructionRegistry result = {
+        .capacity = VM_REGISTRY_MIN_CAPACITY,
+        .size = 0,
+        .collision = false
+    };
+    result.slot = calloc(result.capacity, sizeof(const VMInstructionDescriptor*));
+
+    for(vm_size_t i = 0; i < GIDT.size; i++) vmRegisterInstruction(&result, GIDT.idt + i);
+
+    if(ext != NULL){
+        for(vm_size_t i = 0; i < ext->size; i++){
+            for(vm_size_t j = 0; j < ext->ext[i]->size; j++) vmRegisterInstruction(&result, ext->ext[i]->idt + j);
+        }
+    }
+
+    return result;
+}
+
+void vmReleaseInstructionRegistry(VMInstructionRegistry* reg){
+    free(reg->slot);
+
+    reg->slot = NULL;
+    reg->capacity = 0;
+    reg->size = 0;
+    reg->collision = false;
+}
+
+
+const VMInstructionDescriptor* _vmInstructionDesc(const VMProgram* prog, const VMInstruction* instr, const VMInstructionDescriptorsExt* ext){
+    if(instr->op != VM_OP_EXT) return _vmOpDescriptor(instr->op);
+    if(instr->desc < prog->desc_count) return prog->desc[instr->desc];
+
+    // unresolved instructions are only possible if they were built by hand
+    return vmFindInstruction((const vm_uint32_t*)(prog->code + instr->icode), ext);
+}
+
+void vmExecInstruction(const VMProgram* prog, const VMInstruction* instr, vm_size_t thread, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    if(vm->halt == false){
+        const VMInstructionDescriptor* desc = _vmInstructionDesc(prog, instr, ext);
+
+        if(desc != NULL && instr->op >= VM_OP_GO_R256) VM_DECODED_IMPL(desc->impl)(prog, instr, thread, vm);
+        else if(desc != NULL){
+            switch (desc->itype){
+            case FREE:
+                VM_FREE_IMPL(desc->impl)(thread, vm);
+                break;
+            case SINGLE:
+                VM_SINGLE_IMPL(desc->impl)(VM_OPERAND(prog->code, instr, 0), thread, vm);
+                break;
+            case DOUBLE:
+                VM_DOUBLE_IMPL(desc->impl)(VM_OPERAND(prog->code, instr, 0), VM_OPERAND(prog->code, instr, 1), thread, vm);
+                break;
+            case TRIPLE:
+                VM_TRIPLE_IMPL(desc->impl)(VM_OPERAND(prog->code, instr, 0), VM_OPERAND(prog->code, instr, 1), VM_OPERAND(prog->code, instr, 2), thread, vm);
+                break;
+            default:
+                break;
+            }
+        }
+    }else ; // do some exception here
+}
+
+
+// end of the slice running count-th instruction of a turn, a locked section may cross
+// slices and the turn goes on as if the locked thread got them one by one
+vm_size_t _vmSliceEnd(vm_size_t count, vm_size_t quantum){
+    return count + (quantum - count % quantum) % quantum;
+}
+
+// interpret up to quantum instructions of one thread, returns executed count
+// (VM_STATS counts and VM_TRACE records them here, the threaded loop is not used then)
+#if !defined(VM_THREADED_DISPATCH) || defined(VM_INSTRUMENTED)
+vm_size_t _vmInterpretSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    VMThread* thread = &vm->thread[exec->thread];
+    vm_size_t slice = quantum;
+    vm_size_t done = 0;
+#ifdef VM_STATS
+    // set up for the program by _vmStatsSlice, NULL if out of memory
+    vm_size_t* counts = vm->stats != NULL ? vm->stats->thread[exec->thread].pc : NULL;
+#endif
+#ifdef VM_TRACE
+    VMTrace* trace = vm->trace;
+#endif
+
+    while(done < quantum && thread->lock == false && vm->halt == false && vm->suspend == false){
+        if(thread->pc >= exec->prog->size) break;
+
+        const VMInstruction* instr = exec->prog->program + thread->pc;
+        vm_size_t length = _vmFusedLength(instr);
+
+        // superinstruction runs only as a whole within quantum, locked section
+        // can't be interleaved anyway
+        if(length > 1 && done + length > quantum && instr->op != VM_OP_LOCKED){
+            VMInstruction first = *instr;
+            first.op = instr->base;
+            vmExecInstruction(exec->prog, &first, exec->thread, vm, ext);
+            length = 1;
+        }else vmExecInstruction(exec->prog, instr, exec->thread, vm, ext);
+#ifdef VM_STATS
+        if(counts != NULL){
+            for(vm_size_t i = 0; i < length; i++) counts[instr - exec->prog->program + i]++;
+        }
+#endif
+#ifdef VM_TRACE
+        if(trace != NULL){
+            for(vm_size_t i = 0; i < length; i++) _vmTraceInstr(trace, exec, instr - exec->prog->program + i);
+        }
+#endif
+        done += length;
+        if(done > quantum) quantum = _vmSliceEnd(done, slice);
+
+        if(thread->wait) break;
+        thread->pc += length;
+    }
+
+    return done;
+}
+#else
+#ifndef __GNUC__
+#error "VM_THREADED_DISPATCH requires labels as values (GCC or Clang)"
+#endif
+
+// direct threaded dispatch: every handler jumps straight to the next one
+vm_size_t _vmInterpretSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    static const void* const dispatch[VM_OPCODES_COUNT] = {
+        [VM_OP_EXT] = &&op_ext,
+        [VM_OP_GO_ADR] = &&op_go_adr, [VM_OP_GO_R] = &&op_go_r,
+        [VM_OP_SND_R_R] = &&op_snd_r_r,
+        [VM_OP_SND_NUM_R8] = &&op_snd_num_r8, [VM_OP_SND_NUM_R16] = &&op_snd_num_r16,
+        [VM_OP_SND_NUM_R32] = &&op_snd_num_r32, [VM_OP_SND_NUM_R64] = &&op_snd_num_r64,
+        [VM_OP_SND_NUM_R128] = &&op_snd_num_r128, [VM_OP_SND_NUM_R256] = &&op_snd_num_r256,
+        [VM_OP_PUSH8_NUM] = &&op_push8_num, [VM_OP_PUSH16_NUM] = &&op_push16_num,
+        [VM_OP_PUSH32_NUM] = &&op_push32_num, [VM_OP_PUSH64_NUM] = &&op_push64_num,
+        [VM_OP_PUSH128_NUM] = &&op_push128_num, [VM_OP_PUSH256_NUM] = &&op_push256_num,
+        [VM_OP_PUSH8_R] = &&op_push8_r, [VM_OP_PUSH16_R] = &&op_push16_r,
+        [VM_OP_PUSH32_R] = &&op_push32_r, [VM_OP_PUSH64_R] = &&op_push64_r,
+        [VM_OP_PUSH128_R] = &&op_push128_r, [VM_OP_PUSH256_R] = &&op_push256_r,
+        [VM_OP_POP8] = &&op_pop8, [VM_OP_POP16] = &&op_pop16,
+        [VM_OP_POP32] = &&op_pop32, [VM_OP_POP64] = &&op_pop64,
+        [VM_OP_POP128] = &&op_pop128, [VM_OP_POP256] = &&op_pop256,
+        [VM_OP_INC_R_R] = &&op_inc_r_r, [VM_OP_DEC_R_R] = &&op_dec_r_r,
+        [VM_OP_ASK] = &&op_ask, [VM_OP_ANSWER] = &&op_answer,
+        [VM_OP_LOCK] = &&op_lock, [VM_OP_UNLOCK] = &&op_unlock,
+        [VM_OP_SEND_R] = &&op_send_r, [VM_OP_RECV_R] = &&op_recv_r,
+        [VM_OP_SEND8] = &&op_send8, [VM_OP_SEND16] = &&op_send16,
+        [VM_OP_SEND32] = &&op_send32, [VM_OP_SEND64] = &&op_send64,
+        [VM_OP_SEND128] = &&op_send128, [VM_OP_SEND256] = &&op_send256,
+        [VM_OP_RECV8] = &&op_recv8, [VM_OP_RECV16] = &&op_recv16,
+        [VM_OP_RECV32] = &&op_recv32, [VM_OP_RECV64] = &&op_recv64,
+        [VM_OP_RECV128] = &&op_recv128, [VM_OP_RECV256] = &&op_recv256,
+        [VM_OP_LDS] = &&op_lds, [VM_OP_STS] = &&op_sts,
+        [VM_OP_GO_R256] = &&op_go_r256,
+        [VM_OP_SND_R8_R8] = &&op_snd_r8_r8, [VM_OP_SND_NUM8_R8] = &&op_snd_num8_r8,
+        [VM_OP_PUSH8_R8] = &&op_push8_r8, [VM_OP_POP8_R8] = &&op_pop8_r8,
+        [VM_OP_INC_R8_R8] = &&op_inc_r8_r8, [VM_OP_DEC_R8_R8] = &&op_dec_r8_r8,
+        [VM_OP_SND_R16_R16] = &&op_snd_r16_r16, [VM_OP_SND_NUM16_R16] = &&op_snd_num16_r16,
+        [VM_OP_PUSH16_R16] = &&op_push16_r16, [VM_OP_POP16_R16] = &&op_pop16_r16,
+        [VM_OP_INC_R16_R16] = &&op_inc_r16_r16, [VM_OP_DEC_R16_R16] = &&op_dec_r16_r16,
+        [VM_OP_SND_R32_R32] = &&op_snd_r32_r32, [VM_OP_SND_NUM32_R32] = &&op_snd_num32_r32,
+        [VM_OP_PUSH32_R32] = &&op_push32_r32, [VM_OP_POP32_R32] = &&op_pop32_r32,
+        [VM_OP_INC_R32_R32] = &&op_inc_r32_r32, [VM_OP_DEC_R32_R32] = &&op_dec_r32_r32,
+        [VM_OP_SND_R64_R64] = &&op_snd_r64_r64, [VM_OP_SND_NUM64_R64] = &&op_snd_num64_r64,
+        [VM_OP_PUSH64_R64] = &&op_push64_r64, [VM_OP_POP64_R64] = &&op_pop64_r64,
+        [VM_OP_INC_R64_R64] = &&op_inc_r64_r64, [VM_OP_DEC_R64_R64] = &&op_dec_r64_r64,
+        [VM_OP_SND_R128_R128] = &&op_snd_r128_r128, [VM_OP_SND_NUM128_R128] = &&op_snd_num128_r128,
+        [VM_OP_PUSH128_R128] = &&op_push128_r128, [VM_OP_POP128_R128] = &&op_pop128_r128,
+        [VM_OP_INC_R128_R128] = &&op_inc_r128_r128, [VM_OP_DEC_R128_R128] = &&op_dec_r128_r128,
+        [VM_OP_SND_R256_R256] = &&op_snd_r256_r256, [VM_OP_SND_NUM256_R256] = &&op_snd_num256_r256,
+        [VM_OP_PUSH256_R256] = &&op_push256_r256, [VM_OP_POP256_R256] = &&op_pop256_r256,
+        [VM_OP_INC_R256_R256] = &&op_inc_r256_r256, [VM_OP_DEC_R256_R256] = &&op_dec_r256_r256,
+        [VM_OP_GO_PC] = &&op_go_pc,
+        [VM_OP_PUSH8_IMM] = &&op_push8_imm, [VM_OP_PUSH16_IMM] = &&op_push16_imm,
+        [VM_OP_PUSH32_IMM] = &&op_push32_imm, [VM_OP_PUSH64_IMM] = &&op_push64_imm,
+        [VM_OP_PUSH128_IMM] = &&op_push128_imm, [VM_OP_PUSH256_IMM] = &&op_push256_imm,
+        [VM_OP_ASK_ADR] = &&op_ask_adr,
+        [VM_OP_SND_INC8] = &&op_snd_inc8, [VM_OP_SND_INC16] = &&op_snd_inc16,
+        [VM_OP_SND_INC32] = &&op_snd_inc32, [VM_OP_SND_INC64] = &&op_snd_inc64,
+        [VM_OP_SND_INC128] = &&op_snd_inc128, [VM_OP_SND_INC256] = &&op_snd_inc256,
+        [VM_OP_PUSH_POP8] = &&op_push_pop8, [VM_OP_PUSH_POP16] = &&op_push_pop16,
+        [VM_OP_PUSH_POP32] = &&op_push_pop32, [VM_OP_PUSH_POP64] = &&op_push_pop64,
+        [VM_OP_PUSH_POP128] = &&op_push_pop128, [VM_OP_PUSH_POP256] = &&op_push_pop256,
+        [VM_OP_POP_PUSH8] = &&op_pop_push8, [VM_OP_POP_PUSH16] = &&op_pop_push16,
+        [VM_OP_POP_PUSH32] = &&op_pop_push32, [VM_OP_POP_PUSH64] = &&op_pop_push64,
+        [VM_OP_POP_PUSH128] = &&op_pop_push128, [VM_OP_POP_PUSH256] = &&op_pop_push256,
+        [VM_OP_INC_RUN8] = &&op_inc_run8, [VM_OP_INC_RUN16] = &&op_inc_run16,
+        [VM_OP_INC_RUN32] = &&op_inc_run32, [VM_OP_INC_RUN64] = &&op_inc_run64,
+        [VM_OP_INC_RUN128] = &&op_inc_run128, [VM_OP_INC_RUN256] = &&op_inc_run256,
+        [VM_OP_LOCKED] = &&op_locked
+    };
+
+    VMThread* thread = &vm->thread[exec->thread];
+    const VMInstruction* program = exec->prog->program;
+    const VMInstruction* instr;
+    const VMProgram* prog = exec->prog;
+    const vm_uint8_t* code = prog->code;
+    vm_size_t size = exec->prog->size;
+    vm_size_t tid = exec->thread;
+    vm_size_t slice = quantum;
+    vm_size_t done = 0;
+
+    #define _VM_DISPATCH()\
+        if(done == quantum || thread->lock || vm->halt || vm->suspend) return done;\
+        if(thread->pc >= size) return done;\
+        instr = program + thread->pc;\
+        goto *dispatch[instr->op];
+
+    #define _VM_OPERAND(n) VM_OPERAND(code, instr, n)
+
+    #define _VM_NEXT()\
+        done++;\
+        if(thread->wait) return done;\
+        thread->pc++;\
+        _VM_DISPATCH()
+
+    // superinstruction runs only as a whole within quantum, otherwise its first instruction alone
+    #define _VM_FUSED(handler, length)\
+        if(done + (length) > quantum) goto *dispatch[instr->base];\
+        handler(prog, instr, tid, vm);\
+        done += (length) - 1;\
+        thread->pc += (length) - 1;\
+        _VM_NEXT()
+
+    _VM_DISPATCH()
+
+    op_ext: vmExecInstruction(exec->prog, instr, tid, vm, ext); _VM_NEXT()
+
+    op_go_adr: _vm_go_adr(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_go_r: _vm_go_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_snd_r_r: _vm_snd_r_r(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r8: _vm_snd_num_r8(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r16: _vm_snd_num_r16(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r32: _vm_snd_num_r32(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r64: _vm_snd_num_r64(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r128: _vm_snd_num_r128(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_snd_num_r256: _vm_snd_num_r256(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+
+    op_push8_num: _vm_push8_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push16_num: _vm_push16_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push32_num: _vm_push32_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push64_num: _vm_push64_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push128_num: _vm_push128_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push256_num: _vm_push256_num(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_push8_r: _vm_push8_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push16_r: _vm_push16_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push32_r: _vm_push32_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push64_r: _vm_push64_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push128_r: _vm_push128_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_push256_r: _vm_push256_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_pop8: _vm_pop8(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_pop16: _vm_pop16(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_pop32: _vm_pop32(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_pop64: _vm_pop64(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_pop128: _vm_pop128(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_pop256: _vm_pop256(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_inc_r_r: _vm_inc_r_r(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_dec_r_r: _vm_dec_r_r(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+
+    op_ask: _vm_ask(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_answer: _vm_answer(tid, vm); _VM_NEXT()
+
+    op_lock: _vm_lock(tid, vm); _VM_NEXT()
+    op_unlock: _vm_unlock(tid, vm); _VM_NEXT()
+
+    op_send_r: _vm_send_r(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_recv_r: _vm_recv_r(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_send8: _vm_send8(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_send16: _vm_send16(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_send32: _vm_send32(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_send64: _vm_send64(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_send128: _vm_send128(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_send256: _vm_send256(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+
+    op_recv8: _vm_recv8(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_recv16: _vm_recv16(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_recv32: _vm_recv32(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_recv64: _vm_recv64(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_recv128: _vm_recv128(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+    op_recv256: _vm_recv256(_VM_OPERAND(0), tid, vm); _VM_NEXT()
+
+    op_lds: _vm_lds(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+    op_sts: _vm_sts(_VM_OPERAND(0), _VM_OPERAND(1), tid, vm); _VM_NEXT()
+
+    op_go_r256: _vm_go_r256(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r8_r8: _vm_snd_r8_r8(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num8_r8: _vm_snd_num8_r8(prog, instr, tid, vm); _VM_NEXT()
+    op_push8_r8: _vm_push8_r8(prog, instr, tid, vm); _VM_NEXT()
+    op_pop8_r8: _vm_pop8_r8(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r8_r8: _vm_inc_r8_r8(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r8_r8: _vm_dec_r8_r8(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r16_r16: _vm_snd_r16_r16(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num16_r16: _vm_snd_num16_r16(prog, instr, tid, vm); _VM_NEXT()
+    op_push16_r16: _vm_push16_r16(prog, instr, tid, vm); _VM_NEXT()
+    op_pop16_r16: _vm_pop16_r16(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r16_r16: _vm_inc_r16_r16(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r16_r16: _vm_dec_r16_r16(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r32_r32: _vm_snd_r32_r32(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num32_r32: _vm_snd_num32_r32(prog, instr, tid, vm); _VM_NEXT()
+    op_push32_r32: _vm_push32_r32(prog, instr, tid, vm); _VM_NEXT()
+    op_pop32_r32: _vm_pop32_r32(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r32_r32: _vm_inc_r32_r32(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r32_r32: _vm_dec_r32_r32(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r64_r64: _vm_snd_r64_r64(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num64_r64: _vm_snd_num64_r64(prog, instr, tid, vm); _VM_NEXT()
+    op_push64_r64: _vm_push64_r64(prog, instr, tid, vm); _VM_NEXT()
+    op_pop64_r64: _vm_pop64_r64(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r64_r64: _vm_inc_r64_r64(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r64_r64: _vm_dec_r64_r64(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r128_r128: _vm_snd_r128_r128(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num128_r128: _vm_snd_num128_r128(prog, instr, tid, vm); _VM_NEXT()
+    op_push128_r128: _vm_push128_r128(prog, instr, tid, vm); _VM_NEXT()
+    op_pop128_r128: _vm_pop128_r128(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r128_r128: _vm_inc_r128_r128(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r128_r128: _vm_dec_r128_r128(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_r256_r256: _vm_snd_r256_r256(prog, instr, tid, vm); _VM_NEXT()
+    op_snd_num256_r256: _vm_snd_num256_r256(prog, instr, tid, vm); _VM_NEXT()
+    op_push256_r256: _vm_push256_r256(prog, instr, tid, vm); _VM_NEXT()
+    op_pop256_r256: _vm_pop256_r256(prog, instr, tid, vm); _VM_NEXT()
+    op_inc_r256_r256: _vm_inc_r256_r256(prog, instr, tid, vm); _VM_NEXT()
+    op_dec_r256_r256: _vm_dec_r256_r256(prog, instr, tid, vm); _VM_NEXT()
+
+    op_go_pc: _vm_go_pc(prog, instr, tid, vm); _VM_NEXT()
+
+    op_push8_imm: _vm_push8_imm(prog, instr, tid, vm); _VM_NEXT()
+    op_push16_imm: _vm_push16_imm(prog, instr, tid, vm); _VM_NEXT()
+    op_push32_imm: _vm_push32_imm(prog, instr, tid, vm); _VM_NEXT()
+    op_push64_imm: _vm_push64_imm(prog, instr, tid, vm); _VM_NEXT()
+    op_push128_imm: _vm_push128_imm(prog, instr, tid, vm); _VM_NEXT()
+    op_push256_imm: _vm_push256_imm(prog, instr, tid, vm); _VM_NEXT()
+
+    op_ask_adr: _vm_ask_adr(prog, instr, tid, vm); _VM_NEXT()
+
+    op_snd_inc8: _VM_FUSED(_vm_snd_inc8, 2)
+    op_snd_inc16: _VM_FUSED(_vm_snd_inc16, 2)
+    op_snd_inc32: _VM_FUSED(_vm_snd_inc32, 2)
+    op_snd_inc64: _VM_FUSED(_vm_snd_inc64, 2)
+    op_snd_inc128: _VM_FUSED(_vm_snd_inc128, 2)
+    op_snd_inc256: _VM_FUSED(_vm_snd_inc256, 2)
+
+    op_push_pop8: _VM_FUSED(_vm_push_pop8, 2)
+    op_push_pop16: _VM_FUSED(_vm_push_pop16, 2)
+    op_push_pop32: _VM_FUSED(_vm_push_pop32, 2)
+    op_push_pop64: _VM_FUSED(_vm_push_pop64, 2)
+    op_push_pop128: _VM_FUSED(_vm_push_pop128, 2)
+    op_push_pop256: _VM_FUSED(_vm_push_pop256, 2)
+
+    op_pop_push8: _VM_FUSED(_vm_pop_push8, 2)
+    op_pop_push16: _VM_FUSED(_vm_pop_push16, 2)
+    op_pop_push32: _VM_FUSED(_vm_pop_push32, 2)
+    op_pop_push64: _VM_FUSED(_vm_pop_push64, 2)
+    op_pop_push128: _VM_FUSED(_vm_pop_push128, 2)
+    op_pop_push256: _VM_FUSED(_vm_pop_push256, 2)
+
+    op_inc_run8: _VM_FUSED(_vm_inc_run8, instr->imm)
+    op_inc_run16: _VM_FUSED(_vm_inc_run16, instr->imm)
+    op_inc_run32: _VM_FUSED(_vm_inc_run32, instr->imm)
+    op_inc_run64: _VM_FUSED(_vm_inc_run64, instr->imm)
+    op_inc_run128: _VM_FUSED(_vm_inc_run128, instr->imm)
+    op_inc_run256: _VM_FUSED(_vm_inc_run256, instr->imm)
+
+    // other threads are locked, so the section can't be interleaved anyway
+    op_locked:
+        _vm_locked(prog, instr, tid, vm);
+        done += instr->imm - 1;
+        thread->pc += instr->imm - 1;
+        if(done + 1 > quantum) quantum = _vmSliceEnd(done + 1, slice);
+        _VM_NEXT()
+
+    #undef _VM_FUSED
+    #undef _VM_NEXT
+    #undef _VM_OPERAND
+    #undef _VM_DISPATCH
+}
+#endif
+
+
+/////////////////////////////////////////
+//                 JIT
+/////////////////////////////////////////
+
+// native code (JIT and translated programs) runs decoded register and stack instructions and
+// go num inline, others through their handlers; superinstructions run as their first instruction
+VM_OPCODE _vmNativeOp(const VMInstruction* instr){
+    return (VM_OPCODE)(instr->op >= VM_OP_SND_INC8 ? instr->base : instr->op);
+}
+vm_bool _vmNativeInline(const VMInstruction* instr){
+    VM_OPCODE op = _vmNativeOp(instr);
+    return (op >= VM_OP_SND_R8_R8 && op <= VM_OP_DEC_R256_R256) || (op >= VM_OP_GO_PC && op <= VM_OP_PUSH256_IMM);
+}
+
+// blocks of native code start at 0, at go num targets, after go and at handler calls, which
+// are blocks of their own; rem[pc] is the count of instructions from pc to the end of its block
+// of up to max instructions, NULL if out of memory
+vm_size_t* _vmNativeBlocks(const VMProgram* prog, vm_size_t max){
+    vm_size_t* rem = calloc(prog->size > 0 ? prog->size : 1, sizeof(vm_size_t));
+    if(rem == NULL) return NULL;
+
+    for(vm_size_t i = 0; i < prog->size; i++){
+        const VMInstruction* instr = prog->program + i;
+        VM_OPCODE op = _vmNativeOp(instr);
+        if(op == VM_OP_GO_PC && instr->imm + 1 < prog->size) rem[instr->imm + 1] = 1;
+        if(!_vmNativeInline(instr) || op == VM_OP_GO_PC){
+            rem[i] = 1;
+            if(i + 1 < prog->size) rem[i + 1] = 1;
+        }
+    }
+    rem[0] = 1;
+    for(vm_size_t i = prog->size, count = 0; i-- > 0;){
+        count++;
+        vm_bool leader = rem[i] != 0;
+        rem[i] = count;
+        if(leader) count = 0;
+    }
+
+    // long blocks are split
+    for(vm_size_t i = 0, count = 0; i < prog->size; i++){
+        if(count == 0) count = rem[i] < max ? rem[i] : max;
+        rem[i] = count--;
+    }
+    return rem;
+}
+
+#ifdef VM_JIT
+// x86-64 code of a whole program: decoded register and stack instructions and go num are
+// emitted inline, others call the handlers through _vmJitCall. A block of inline instructions
+// takes its length of quantum at once and is entered only at its start, the interpreter runs
+// the rest of quantum shorter than a block and threads stopped inside one, so TDM slices end
+// where the interpreter's do
+#ifndef VM_JIT_THRESHOLD
+#define VM_JIT_THRESHOLD 100000 // instructions interpreted before a program is compiled
+#endif
+#ifndef VM_JIT_BLOCK
+#define VM_JIT_BLOCK 32 // instructions in a block at most, shorter slices are interpreted
+#endif
+#if VM_JIT_BLOCK < 1 || VM_JIT_BLOCK > 127
+#error VM_JIT_BLOCK must be in 1..127
+#endif
+
+// passed to native code in rdi, kept in rbx
+typedef struct VMJitFrame{
+    const VMProgram* prog;
+    const VMInstructionDescriptorsExt* ext;
+    VMInstance* vm;
+    VMThread* thread;
+    vm_uint8_t* regs; // register bank of the thread
+    vm_size_t tid;
+    vm_bool exit; // set by _vmJitCall when native code must return
+} VMJitFrame;
+
+typedef enum _VM_JIT_FIXUP{
+    VM_JIT_TO_INSTR, // start of instruction pc
+    VM_JIT_TO_STUB, // gives count back to quantum and returns with pc
+    VM_JIT_TO_EXIT, // returns with pc in rax
+    VM_JIT_TO_DISPATCH // jumps to instruction rax
+} VM_JIT_FIXUP;
+
+typedef struct VMJitFixup{
+    vm_size_t at; // of rel32
+    VM_JIT_FIXUP kind;
+    vm_size_t pc, count;
+} VMJitFixup;
+
+typedef struct VMJitBuffer{
+    vm_uint8_t* code;
+    vm_size_t size, capacity;
+    VMJitFixup* fixup;
+    vm_size_t fixup_count, fixup_capacity;
+    vm_bool failed; // out of memory
+} VMJitBuffer;
+
+#define _VM_JIT_RDX 2
+#define _VM_JIT_RBX 3
+#define _VM_JIT_R13 13 // register bank
+#define _VM_JIT_R14 14 // VMInstance
+#define _VM_JIT_R15 15 // VMThread, r12 holds the rest of quantum
+
+void _vmJitBytes(VMJitBuffer* buf, const void* bytes, vm_size_t size){
+    if(buf->size + size > buf->capacity){
+        vm_size_t capacity = buf->capacity == 0 ? 4096 : buf->capacity;
+        while(capacity < buf->size + size) capacity *= 2;
+
+        vm_uint8_t* code = realloc(buf->code, capacity);
+        if(code == NULL){
+            buf->failed = true;
+            return;
+        }
+        buf->code = code;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->code + buf->size, bytes, size);
+    buf->size += size;
+}
+void _vmJitByte(VMJitBuffer* buf, vm_uint8_t byte){
+    _vmJitBytes(buf, &byte, 1);
+}
+void _vmJitU32(VMJitBuffer* buf, uint32_t value){
+    _vmJitBytes(buf, &value, sizeof(value));
+}
+
+// rel32 at the end of the last instruction, resolved by _vmJitLink
+void _vmJitRel(VMJitBuffer* buf, VM_JIT_FIXUP kind, vm_size_t pc, vm_size_t count){
+    if(buf->fixup_count == buf->fixup_capacity){
+        vm_size_t capacity = buf->fixup_capacity == 0 ? 256 : buf->fixup_capacity * 2;
+        VMJitFixup* fixup = realloc(buf->fixup, capacity * sizeof(VMJitFixup));
+        if(fixup == NULL){
+            buf->failed = true;
+            return;
+        }
+        buf->fixup = fixup;
+        buf->fixup_capacity = capacity;
+    }
+    buf->fixup[buf->fixup_count++] = (VMJitFixup){.at = buf->size, .kind = kind, .pc = pc, .count = count};
+    _vmJitU32(buf, 0);
+}
+
+// modrm with [base + disp], base is never rsp or r12
+void _vmJitModrm(VMJitBuffer* buf, int reg, int base, vm_size_t disp){
+    if(disp < 0x80){
+        _vmJitByte(buf, 0x40 | (reg & 7) << 3 | (base & 7));
+        _vmJitByte(buf, (vm_uint8_t)disp);
+    }else{
+        _vmJitByte(buf, 0x80 | (reg & 7) << 3 | (base & 7));
+        _vmJitU32(buf, (uint32_t)disp);
+    }
+}
+
+// mov between al / ax / eax / rax and [base + disp]
+void _vmJitMov(VMJitBuffer* buf, vm_bool load, vm_size_t size, int base, vm_size_t disp){
+    vm_uint8_t rex = 0x40 | (size == 8 ? 0x08 : 0) | (base >= 8 ? 0x01 : 0);
+
+    if(size == 2) _vmJitByte(buf, 0x66);
+    if(rex != 0x40) _vmJitByte(buf, rex);
+    _vmJitByte(buf, size == 1 ? (load ? 0x8a : 0x88) : (load ? 0x8b : 0x89));
+    _vmJitModrm(buf, 0, base, disp);
+}
+
+// copy of size bytes between [from + from_disp] and [to + to_disp] through rax
+void _vmJitCopy(VMJitBuffer* buf, vm_size_t size, int to, vm_size_t to_disp, int from, vm_size_t from_disp){
+    vm_size_t chunk = size < 8 ? size : 8;
+
+    for(vm_size_t i = 0; i < size; i += chunk){
+        _vmJitMov(buf, true, chunk, from, from_disp + i);
+        _vmJitMov(buf, false, chunk, to, to_disp + i);
+    }
+}
+
+// store of size bytes of num to [base + disp]
+void _vmJitStore(VMJitBuffer* buf, vm_size_t size, int base, vm_size_t disp, const vm_uint8_t* num){
+    if(size >= 8){
+        for(vm_size_t i = 0; i < size; i += 8){
+            vm_uint8_t mov_rax[2] = {0x48, 0xb8};
+            _vmJitBytes(buf, mov_rax, sizeof(mov_rax));
+            _vmJitBytes(buf, num + i, 8);
+            _vmJitMov(buf, false, 8, base, disp + i);
+        }
+        return;
+    }
+
+    if(size == 2) _vmJitByte(buf, 0x66);
+    if(base >= 8) _vmJitByte(buf, 0x41);
+    _vmJitByte(buf, size == 1 ? 0xc6 : 0xc7);
+    _vmJitModrm(buf, 0, base, disp);
+    _vmJitBytes(buf, num, size);
+}
+
+// bswap of the number in rax, registers keep bytecode byte order
+void _vmJitSwap(VMJitBuffer* buf, vm_size_t size){
+#ifndef VM_REGISTERS_LE
+    static const vm_uint8_t rol_ax[4] = {0x66, 0xc1, 0xc0, 0x08}, bswap_eax[2] = {0x0f, 0xc8}, bswap_rax[3] = {0x48, 0x0f, 0xc8};
+
+    if(size == 2) _vmJitBytes(buf, rol_ax, sizeof(rol_ax));
+    else if(size == 4) _vmJitBytes(buf, bswap_eax, sizeof(bswap_eax));
+    else if(size >= 8) _vmJitBytes(buf, bswap_rax, sizeof(bswap_rax));
+#endif
+}
+
+// inc / dec of size bytes register from into to, wider ones by an add / adc chain of qwords
+void _vmJitInc(VMJitBuffer* buf, vm_size_t size, vm_size_t to, vm_size_t from, vm_bool dec){
+    vm_size_t chunk = size < 8 ? size : 8;
+    vm_size_t count = size / chunk;
+
+    for(vm_size_t n = 0; n < count; n++){
+#ifdef VM_REGISTERS_LE
+        vm_size_t at = n * chunk; // lowest qword first
+#else
+        vm_size_t at = (count - n - 1) * chunk;
+#endif
+        _vmJitMov(buf, true, chunk, _VM_JIT_R13, from + at);
+        _vmJitSwap(buf, chunk);
+
+        if(chunk == 1){
+            vm_uint8_t op[2] = {dec ? 0x2c : 0x04, 0x01}; // sub / add al, 1
+            _vmJitBytes(buf, op, sizeof(op));
+        }else{
+            if(chunk == 2) _vmJitByte(buf, 0x66);
+            if(chunk == 8) _vmJitByte(buf, 0x48);
+            // add / sub 1 for the lowest part, adc / sbb 0 for the others
+            vm_uint8_t op[3] = {0x83, n == 0 ? (dec ? 0xe8 : 0xc0) : (dec ? 0xd8 : 0xd0), n == 0 ? 0x01 : 0x00};
+            _vmJitBytes(buf, op, sizeof(op));
+        }
+
+        _vmJitSwap(buf, chunk);
+        _vmJitMov(buf, false, chunk, _VM_JIT_R13, to + at);
+    }
+}
+
+vm_size_t _vmJitStackOffset(vm_size_t size){
+    switch(size){
+    case 1: return offsetof(VMInstance, stack8);
+    case 2: return offsetof(VMInstance, stack16);
+    case 4: return offsetof(VMInstance, stack32);
+    case 8: return offsetof(VMInstance, stack64);
+    case 16: return offsetof(VMInstance, stack128);
+    default: return offsetof(VMInstance, stack256);
+    }
+}
+vm_size_t _vmJitEndOffset(vm_size_t size){
+    switch(size){
+    case 1: return offsetof(VMInstance, se8);
+    case 2: return offsetof(VMInstance, se16);
+    case 4: return offsetof(VMInstance, se32);
+    case 8: return offsetof(VMInstance, se64);
+    case 16: return offsetof(VMInstance, se128);
+    default: return offsetof(VMInstance, se256);
+    }
+}
+
+// pc of an instruction hitting a guard page is kept as the interpreter does
+#ifdef VM_GUARDED_STACKS
+#define _VM_JIT_FAULT_PC true
+#else
+#define _VM_JIT_FAULT_PC false
+#endif
+
+// rdx = address of element se (after dec for pop) of the size bytes stack
+void _vmJitStackTop(VMJitBuffer* buf, vm_size_t size, vm_bool pop, vm_size_t pc){
+    int shift = 0;
+    while(((vm_size_t)1 << shift) < size) shift++;
+
+    if(_VM_JIT_FAULT_PC){
+        vm_uint8_t mov_pc[3] = {0x49, 0xc7, 0x87};
+        _vmJitBytes(buf, mov_pc, sizeof(mov_pc));
+        _vmJitU32(buf, (uint32_t)offsetof(VMThread, pc));
+        _vmJitU32(buf, (uint32_t)pc);
+    }
+
+    if(pop){
+        vm_uint8_t dec_se[2] = {0x49, 0xff};
+        _vmJitBytes(buf, dec_se, sizeof(dec_se));
+        _vmJitModrm(buf, 1, _VM_JIT_R14, _vmJitEndOffset(size));
+    }
+
+    vm_uint8_t mov_rcx[2] = {0x49, 0x8b}, mov_rdx[2] = {0x49, 0x8b};
+    _vmJitBytes(buf, mov_rcx, sizeof(mov_rcx));
+    _vmJitModrm(buf, 1, _VM_JIT_R14, _vmJitEndOffset(size));
+    _vmJitBytes(buf, mov_rdx, sizeof(mov_rdx));
+    _vmJitModrm(buf, _VM_JIT_RDX, _VM_JIT_R14, _vmJitStackOffset(size));
+
+    if(shift > 0){
+        vm_uint8_t shl_rcx[4] = {0x48, 0xc1, 0xe1, (vm_uint8_t)shift};
+        _vmJitBytes(buf, shl_rcx, sizeof(shl_rcx));
+    }
+    vm_uint8_t add_rdx_rcx[3] = {0x48, 0x01, 0xca};
+    _vmJitBytes(buf, add_rdx_rcx, sizeof(add_rdx_rcx));
+}
+
+void _vmJitPushEnd(VMJitBuffer* buf, vm_size_t size){
+    vm_uint8_t inc_se[2] = {0x49, 0xff};
+    _vmJitBytes(buf, inc_se, sizeof(inc_se));
+    _vmJitModrm(buf, 0, _VM_JIT_R14, _vmJitEndOffset(size));
+}
+
+// runs instruction pc by its handler, returns pc to go on from, or pc to return with
+// if the interpreter would stop here (wait, lock, halt, suspend or end of program)
+vm_size_t _vmJitCall(VMJitFrame* frame, vm_size_t pc){
+    VMThread* thread = frame->thread;
+    VMInstance* vm = frame->vm;
+    const VMInstruction* instr = frame->prog->program + pc;
+    VMInstruction first;
+
+    // superinstructions run one instruction at a time
+    if(instr->op >= VM_OP_SND_INC8){
+        first = *instr;
+        first.op = instr->base;
+        instr = &first;
+    }
+
+    thread->pc = pc;
+    vmExecInstruction(frame->prog, instr, frame->tid, vm, frame->ext);
+
+    if(thread->wait){
+        frame->exit = true;
+        return thread->pc;
+    }
+
+    pc = thread->pc + 1;
+    frame->exit = thread->lock || vm->halt || vm->suspend || pc >= frame->prog->size;
+    return pc;
+}
+
+void _vmJitCallOut(VMJitBuffer* buf, vm_size_t pc){
+    vm_size_t (*call)(VMJitFrame*, vm_size_t) = _vmJitCall;
+    vm_uint8_t mov_rdi_rbx[3] = {0x48, 0x89, 0xdf}, mov_esi[1] = {0xbe}, mov_rax[2] = {0x48, 0xb8}, call_rax[2] = {0xff, 0xd0};
+    vm_uint8_t cmp_exit[2] = {0x83, 0xbb}, jne[2] = {0x0f, 0x85}, cmp_rax[2] = {0x48, 0x3d};
+
+    _vmJitBytes(buf, mov_rdi_rbx, sizeof(mov_rdi_rbx));
+    _vmJitBytes(buf, mov_esi, sizeof(mov_esi));
+    _vmJitU32(buf, (uint32_t)pc);
+    _vmJitBytes(buf, mov_rax, sizeof(mov_rax));
+    _vmJitBytes(buf, &call, sizeof(call));
+    _vmJitBytes(buf, call_rax, sizeof(call_rax));
+
+    _vmJitBytes(buf, cmp_exit, sizeof(cmp_exit));
+    _vmJitU32(buf, (uint32_t)offsetof(VMJitFrame, exit));
+    _vmJitByte(buf, 0);
+    _vmJitBytes(buf, jne, sizeof(jne));
+    _vmJitRel(buf, VM_JIT_TO_EXIT, 0, 0);
+
+    // go and go r256 of extensions land anywhere
+    _vmJitBytes(buf, cmp_rax, sizeof(cmp_rax));
+    _vmJitU32(buf, (uint32_t)(pc + 1));
+    _vmJitBytes(buf, jne, sizeof(jne));
+    _vmJitRel(buf, VM_JIT_TO_DISPATCH, 0, 0);
+}
+
+void _vmJitInstruction(VMJitBuffer* buf, const VMProgram* prog, vm_size_t pc){
+    const VMInstruction* instr = prog->program + pc;
+    VM_OPCODE op = _vmNativeOp(instr);
+
+    if(op >= VM_OP_SND_R8_R8 && op <= VM_OP_SND_R256_R256){
+        vm_size_t size = (vm_size_t)1 << (op - VM_OP_SND_R8_R8);
+        _vmJitCopy(buf, size, _VM_JIT_R13, instr->r1, _VM_JIT_R13, instr->r0);
+    }else if(op >= VM_OP_SND_NUM8_R8 && op <= VM_OP_SND_NUM256_R256){
+        vm_size_t size = (vm_size_t)1 << (op - VM_OP_SND_NUM8_R8);
+        _vmJitStore(buf, size, _VM_JIT_R13, instr->r1, _vmImmediate(prog, instr, size));
+    }else if(op >= VM_OP_PUSH8_R8 && op <= VM_OP_PUSH256_R256){
+        vm_size_t size = (vm_size_t)1 << (op - VM_OP_PUSH8_R8);
+        _vmJitStackTop(buf, size, false, pc);
+        _vmJitCopy(buf, size, _VM_JIT_RDX, 0, _VM_JIT_R13, instr->r0);
+        _vmJitPushEnd(buf, size);
+    }else if(op >= VM_OP_PUSH8_IMM && op <= VM_OP_PUSH256_IMM){
+        vm_size_t size = (vm_size_t)1 << (op - VM_OP_PUSH8_IMM);
+        _vmJitStackTop(buf, size, false, pc);
+        _vmJitStore(buf, size, _VM_JIT_RDX, 0, _vmImmediate(prog, instr, size));
+        _vmJitPushEnd(buf, size);
+    }else if(op >= VM_OP_POP8_R8 && op <= VM_OP_POP256_R256){
+        vm_size_t size = (vm_size_t)1 << (op - VM_OP_POP8_R8);
+        _vmJitStackTop(buf, size, true, pc);
+        _vmJitCopy(buf, size, _VM_JIT_R13, instr->r0, _VM_JIT_RDX, 0);
+    }else if(op >= VM_OP_INC_R8_R8 && op <= VM_OP_INC_R256_R256){
+        _vmJitInc(buf, (vm_size_t)1 << (op - VM_OP_INC_R8_R8), instr->r1, instr->r0, false);
+    }else if(op >= VM_OP_DEC_R8_R8 && op <= VM_OP_DEC_R256_R256){
+        _vmJitInc(buf, (vm_size_t)1 << (op - VM_OP_DEC_R8_R8), instr->r1, instr->r0, true);
+    }else if(op == VM_OP_GO_PC && instr->imm + 1 < prog->size){
+        // pc is incremented after go, suspend is noticed here and in calls
+        vm_uint8_t cmp_suspend[3] = {0x41, 0x83, 0xbe}, jne[2] = {0x0f, 0x85}, jmp[1] = {0xe9};
+        _vmJitBytes(buf, cmp_suspend, sizeof(cmp_suspend));
+        _vmJitU32(buf, (uint32_t)offsetof(VMInstance, suspend));
+        _vmJitByte(buf, 0);
+        _vmJitBytes(buf, jne, sizeof(jne));
+        _vmJitRel(buf, VM_JIT_TO_STUB, instr->imm + 1, 0);
+        _vmJitBytes(buf, jmp, sizeof(jmp));
+        _vmJitRel(buf, VM_JIT_TO_INSTR, instr->imm + 1, 0);
+    }else if(op == VM_OP_GO_PC){
+        vm_uint8_t jmp[1] = {0xe9};
+        _vmJitBytes(buf, jmp, sizeof(jmp));
+        _vmJitRel(buf, VM_JIT_TO_STUB, instr->imm + 1, 0);
+    }else _vmJitCallOut(buf, pc);
+}
+
+// takes count of quantum, jumps to a stub giving it back if quantum is shorter
+void _vmJitBlock(VMJitBuffer* buf, vm_size_t pc, vm_size_t count){
+    vm_uint8_t sub_r12[3] = {0x49, 0x83, 0xec}, jb[2] = {0x0f, 0x82};
+    _vmJitBytes(buf, sub_r12, sizeof(sub_r12));
+    _vmJitByte(buf, (vm_uint8_t)count);
+    _vmJitBytes(buf, jb, sizeof(jb));
+    _vmJitRel(buf, VM_JIT_TO_STUB, pc, count);
+}
+
+// resolves jumps and appends stubs, exits, dispatch and the entries table
+void _vmJitLink(VMJitBuffer* buf, const vm_size_t* entry, vm_size_t size){
+    // returns with pc in rax
+    vm_uint8_t exit_pc[3] = {0x49, 0x89, 0x87}; // mov [r15 + pc], rax
+    vm_uint8_t epilogue[18] = {
+        0x4c, 0x89, 0xe0, // mov rax, r12
+        0x48, 0x83, 0xc4, 0x08, // add rsp, 8
+        0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, // pop r15 ... rbx
+        0xc3
+    };
+    vm_size_t exit_at = buf->size;
+    _vmJitBytes(buf, exit_pc, sizeof(exit_pc));
+    _vmJitU32(buf, (uint32_t)offsetof(VMThread, pc));
+    _vmJitBytes(buf, epilogue, sizeof(epilogue));
+
+    // jumps to instruction rax by the entries table, returns if it is inside a block
+    vm_uint8_t lea_rcx[3] = {0x48, 0x8d, 0x0d}; // lea rcx, [code]
+    vm_uint8_t movsxd[4] = {0x48, 0x63, 0x94, 0x81}; // movsxd rdx, [rcx + rax * 4 + table]
+    vm_uint8_t test_js[4] = {0x48, 0x85, 0xd2, 0x78}; // test rdx, rdx; js exit
+    vm_uint8_t jump[5] = {0x48, 0x01, 0xca, 0xff, 0xe2}; // add rdx, rcx; jmp rdx
+    vm_size_t dispatch_at = buf->size;
+    _vmJitBytes(buf, lea_rcx, sizeof(lea_rcx));
+    _vmJitU32(buf, (uint32_t)(0 - (buf->size + 4)));
+    _vmJitBytes(buf, movsxd, sizeof(movsxd));
+    vm_size_t table_disp = buf->size;
+    _vmJitU32(buf, 0);
+    _vmJitBytes(buf, test_js, sizeof(test_js));
+    _vmJitByte(buf, (vm_uint8_t)(exit_at - (buf->size + 1)));
+    _vmJitBytes(buf, jump, sizeof(jump));
+
+    for(vm_size_t i = 0; i < buf->fixup_count && !buf->failed; i++){
+        VMJitFixup fixup = buf->fixup[i];
+        vm_size_t target = 0;
+
+        switch(fixup.kind){
+        case VM_JIT_TO_INSTR: target = entry[fixup.pc]; break;
+        case VM_JIT_TO_EXIT: target = exit_at; break;
+        case VM_JIT_TO_DISPATCH: target = dispatch_at; break;
+        default:{
+            // add r12, count; mov eax, pc; jmp exit
+            vm_uint8_t add_r12[3] = {0x49, 0x83, 0xc4}, mov_eax[1] = {0xb8}, jmp[1] = {0xe9};
+            target = buf->size;
+            if(fixup.count > 0){
+                _vmJitBytes(buf, add_r12, sizeof(add_r12));
+                _vmJitByte(buf, (vm_uint8_t)fixup.count);
+            }
+            _vmJitBytes(buf, mov_eax, sizeof(mov_eax));
+            _vmJitU32(buf, (uint32_t)fixup.pc);
+            _vmJitBytes(buf, jmp, sizeof(jmp));
+            _vmJitU32(buf, (uint32_t)(exit_at - (buf->size + 4)));
+        }
+        }
+
+        if(!buf->failed){
+            uint32_t rel = (uint32_t)(target - (fixup.at + 4));
+            memcpy(buf->code + fixup.at, &rel, sizeof(rel));
+        }
+    }
+
+    while(buf->size % 4 != 0) _vmJitByte(buf, 0xcc);
+    vm_size_t table = buf->size;
+    for(vm_size_t i = 0; i < size; i++) _vmJitU32(buf, (uint32_t)entry[i]);
+
+    if(!buf->failed){
+        uint32_t disp = (uint32_t)table;
+        memcpy(buf->code + table_disp, &disp, sizeof(disp));
+    }
+}
+
+// compiles verified program to native code once, programs hot in the interpreter are compiled
+// by the scheduler, false if the program is not verified or out of memory
+vm_bool vmJitProgram(VMProgram* prog){
+    if(__atomic_load_n(&prog->jit, __ATOMIC_ACQUIRE) != NULL) return true;
+    if(prog->size == 0 || prog->size >= INT32_MAX / 64) return false;
+
+    // checked instructions would all be calls, slower than the interpreter
+    for(vm_size_t i = 0; i < prog->size; i++)
+        if(prog->program[i].op >= VM_OP_GO_ADR && prog->program[i].op <= VM_OP_DEC_R_R) return false;
+
+    VMJitBuffer buf = {.code = NULL};
+    vm_size_t* entry = malloc(prog->size * sizeof(vm_size_t));
+    vm_size_t* rem = _vmNativeBlocks(prog, VM_JIT_BLOCK);
+    if(entry == NULL || rem == NULL){
+        free(entry);
+        free(rem);
+        return false;
+    }
+
+    // vm_size_t f(VMJitFrame* frame, const void* entry, vm_size_t quantum): returns the rest of quantum
+    vm_uint8_t prologue[] = {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, // push rbx ... r15
+        0x48, 0x83, 0xec, 0x08, // sub rsp, 8
+        0x48, 0x89, 0xfb, // mov rbx, rdi
+        0x49, 0x89, 0xd4 // mov r12, rdx
+    };
+    vm_uint8_t mov_r13[3] = {0x4c, 0x8b, 0xab}, mov_r14[3] = {0x4c, 0x8b, 0xb3}, mov_r15[3] = {0x4c, 0x8b, 0xbb}, jmp_rsi[2] = {0xff, 0xe6};
+    _vmJitBytes(&buf, prologue, sizeof(prologue));
+    _vmJitBytes(&buf, mov_r13, sizeof(mov_r13));
+    _vmJitU32(&buf, (uint32_t)offsetof(VMJitFrame, regs));
+    _vmJitBytes(&buf, mov_r14, sizeof(mov_r14));
+    _vmJitU32(&buf, (uint32_t)offsetof(VMJitFrame, vm));
+    _vmJitBytes(&buf, mov_r15, sizeof(mov_r15));
+    _vmJitU32(&buf, (uint32_t)offsetof(VMJitFrame, thread));
+    _vmJitBytes(&buf, jmp_rsi, sizeof(jmp_rsi));
+
+    for(vm_size_t i = 0, count = 0; i < prog->size; i++){
+        entry[i] = buf.size;
+        if(count == 0){
+            count = rem[i];
+            _vmJitBlock(&buf, i, count);
+        }
+        count--;
+        _vmJitInstruction(&buf, prog, i);
+    }
+
+    // end of program
+    vm_uint8_t mov_eax[1] = {0xb8}, jmp[1] = {0xe9};
+    _vmJitBytes(&buf, mov_eax, sizeof(mov_eax));
+    _vmJitU32(&buf, (uint32_t)prog->size);
+    _vmJitBytes(&buf, jmp, sizeof(jmp));
+    _vmJitRel(&buf, VM_JIT_TO_EXIT, 0, 0);
+
+    // instructions inside blocks have no entry, but minus the count left to the end of the block
+    for(vm_size_t i = 0, count = 0; i < prog->size; i++){
+        if(count == 0) count = rem[i];
+        else entry[i] = 0 - rem[i];
+        count--;
+    }
+    free(rem);
+
+    _vmJitLink(&buf, entry, prog->size);
+    free(entry);
+    free(buf.fixup);
+
+    VMJitCode* jit = malloc(sizeof(VMJitCode));
+    void* code = buf.failed || jit == NULL ? MAP_FAILED : mmap(NULL, buf.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(code == MAP_FAILED){
+        free(buf.code);
+        free(jit);
+        return false;
+    }
+
+    memcpy(code, buf.code, buf.size);
+    mprotect(code, buf.size, PROT_READ | PROT_EXEC);
+    *jit = (VMJitCode){.code = code, .size = buf.size, .table = buf.size - prog->size * sizeof(int32_t)};
+    free(buf.code);
+
+    // parallel workers may compile the same program at once, the first one wins
+    VMJitCode* expected = NULL;
+    if(!__atomic_compare_exchange_n(&prog->jit, &expected, jit, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        munmap(jit->code, jit->size);
+        free(jit);
+    }
+    return true;
+}
+
+vm_size_t _vmJitSlice(const VMExec* exec, const VMJitCode* jit, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    VMThread* thread = &vm->thread[exec->thread];
+    VMJitFrame frame = {
+        .prog = exec->prog,
+        .ext = ext,
+        .vm = vm,
+        .thread = thread,
+        .regs = (vm_uint8_t*)&VM_BANK(exec->thread, vm).r0,
+        .tid = exec->thread
+    };
+    const int32_t* entry = (const int32_t*)(jit->code + jit->table);
+    vm_size_t (*run)(VMJitFrame*, const void*, vm_size_t) = (vm_size_t (*)(VMJitFrame*, const void*, vm_size_t))(void*)jit->code;
+    vm_size_t done = 0;
+
+    while(done < quantum && !frame.exit && !thread->lock && !vm->halt && !vm->suspend && thread->pc < exec->prog->size){
+        int32_t at = entry[thread->pc];
+
+        if(at < 0){
+            // the rest of a block is interpreted up to the next entry
+            vm_size_t count = (vm_size_t)-at < quantum - done ? (vm_size_t)-at : quantum - done;
+            vm_size_t step = _vmInterpretSlice(exec, count, vm, ext);
+            done += step;
+            if(step < count) break;
+        }else{
+            vm_size_t left = run(&frame, jit->code + at, quantum - done);
+            vm_size_t step = quantum - done - left;
+            done += step;
+
+            // returned at an entry with quantum shorter than its block, interpreted to the end
+            if(!frame.exit && step == 0 && thread->pc < exec->prog->size && entry[thread->pc] >= 0 && !vm->suspend){
+                done += _vmInterpretSlice(exec, quantum - done, vm, ext);
+                break;
+            }
+        }
+    }
+    return done;
+}
+#endif
+
+#ifdef VM_INSTRUMENTED
+// counted / traced slice, always interpreted: native and translated code don't see single instructions
+vm_size_t _vmInstrumentedSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    const VMThread* thread = &vm->thread[exec->thread];
+    vm_bool halt = vm->halt;
+
+#ifdef VM_STATS
+    VMThreadStats* stats = vm->stats != NULL ? vm->stats->thread + exec->thread : NULL;
+    if(stats != NULL) _vmStatsProgram(stats, exec->prog);
+#endif
+#ifdef VM_TRACE
+    _vmTrace(vm->trace, exec->thread, thread->pc, NULL, VM_TRACE_SLICE);
+#endif
+
+    vm_size_t done = _vmInterpretSlice(exec, quantum, vm, ext);
+
+#ifdef VM_STATS
+    if(stats != NULL){
+        stats->executed += done;
+        stats->slices++;
+        if(thread->wait) stats->waits++;
+        if(!halt && vm->halt) stats->halts++;
+    }
+#endif
+#ifdef VM_TRACE
+    if(thread->wait) _vmTrace(vm->trace, exec->thread, thread->pc, NULL, VM_TRACE_WAIT);
+    if(!halt && vm->halt) _vmTrace(vm->trace, exec->thread, thread->pc, NULL, VM_TRACE_HALT);
+    _vmTrace(vm->trace, exec->thread, thread->pc, NULL, VM_TRACE_YIELD);
+#endif
+    return done;
+}
+#endif
+
+// execute up to quantum instructions of one thread on the fastest tier, returns executed count
+vm_size_t _vmDispatchSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+#ifdef VM_INSTRUMENTED
+    return _vmInstrumentedSlice(exec, quantum, vm, ext);
+#endif
+    if(exec->prog->slice != NULL) return exec->prog->slice(exec, quantum, vm, ext);
+
+#ifdef VM_JIT
+    VMProgram* prog = exec->prog;
+    const VMJitCode* jit = __atomic_load_n(&prog->jit, __ATOMIC_ACQUIRE);
+
+    if(jit != NULL && quantum >= VM_JIT_BLOCK) return _vmJitSlice(exec, jit, quantum, vm, ext);
+
+    vm_size_t done = _vmInterpretSlice(exec, quantum, vm, ext);
+    if(jit == NULL){
+        // tier up once, when heat crosses VM_JIT_THRESHOLD, programs failing to compile stay interpreted
+        vm_size_t heat = __atomic_add_fetch(&prog->heat, done, __ATOMIC_RELAXED);
+        if(heat >= VM_JIT_THRESHOLD && heat - done < VM_JIT_THRESHOLD) vmJitProgram(prog);
+    }
+    return done;
+#else
+    return _vmInterpretSlice(exec, quantum, vm, ext);
+#endif
+}
+
+#ifdef VM_PERF
+int _vmPerfOpen(uint32_t type, uint64_t config, int group){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1; // allowed by the default perf_event_paranoid
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0); // this OS thread, any cpu
+}
+
+// counts from now on (deltas are taken, counters are never stopped), events the host doesn't
+// have are left out, false if none can be opened (the instance runs as without it)
+vm_bool vmPerfStart(VMInstance* vm, VM_PERF_MODE mode){
+    static const uint32_t type[VM_PERF_EVENTS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE
+    };
+    static const uint64_t config[VM_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_TASK_CLOCK
+    };
+
+    vmPerfStop(vm);
+
+    VMPerf* perf = calloc(1, sizeof(VMPerf));
+    if(perf == NULL) return false;
+
+    perf->mode = mode;
+    perf->leader = -1;
+    for(vm_size_t i = 0; i < VM_PERF_EVENTS; i++){
+        perf->fd[i] = _vmPerfOpen(type[i], config[i], perf->leader);
+        perf->slot[i] = perf->fd[i] >= 0 ? perf->members++ : -1;
+        if(perf->leader < 0) perf->leader = perf->fd[i];
+    }
+
+    perf->threads_count = vm->threads_count;
+    if(mode != VM_PERF_RUN) perf->thread = calloc(vm->threads_count > 0 ? vm->threads_count : 1, sizeof(VMPerfCounts));
+    if(mode == VM_PERF_OPCODES){
+        perf->op = calloc(VM_OPCODES_COUNT, sizeof(VMPerfCounts));
+        perf->op_count = calloc(VM_OPCODES_COUNT, sizeof(uint64_t));
+    }
+
+    vm->perf = perf;
+    if(perf->leader < 0 || (mode != VM_PERF_RUN && perf->thread == NULL) || (mode == VM_PERF_OPCODES && (perf->op == NULL || perf->op_count == NULL))){
+        vmPerfStop(vm);
+        return false;
+    }
+    return true;
+}
+
+vm_bool _vmPerfRead(const VMPerf* perf, VMPerfCounts* counts){
+    uint64_t group[1 + VM_PERF_EVENTS]; // count of members and their values
+    if(read(perf->leader, group, sizeof(group)) < (ssize_t)((1 + perf->members) * sizeof(uint64_t))) return false;
+
+    for(vm_size_t i = 0; i < VM_PERF_EVENTS; i++) counts->value[i] = perf->slot[i] >= 0 ? group[1 + perf->slot[i]] : 0;
+    return true;
+}
+
+void _vmPerfAdd(VMPerfCounts* counts, const VMPerfCounts* before, const VMPerfCounts* after){
+    for(vm_size_t i = 0; i < VM_PERF_EVENTS; i++) counts->value[i] += after->value[i] - before->value[i];
+}
+
+// slice with counters read around it, or around every instruction with VM_PERF_OPCODES
+vm_size_t _vmPerfSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    VMPerf* perf = vm->perf;
+    VMPerfCounts before, after;
+
+    if(perf->mode == VM_PERF_SLICES){
+        vm_bool ok = _vmPerfRead(perf, &before);
+        vm_size_t done = _vmDispatchSlice(exec, quantum, vm, ext);
+
+        if(ok && _vmPerfRead(perf, &after)) _vmPerfAdd(perf->thread + exec->thread, &before, &after);
+        return done;
+    }
+
+    // one instruction at a time (interpreted, superinstructions split), the slice ends where it would
+    const VMThread* thread = &vm->thread[exec->thread];
+    vm_size_t slice = quantum;
+    vm_size_t done = 0;
+
+    while(done < quantum && thread->pc < exec->prog->size){
+        const VMInstruction* instr = exec->prog->program + thread->pc;
+        VM_OPCODE op = _vmFusedLength(instr) > 1 && instr->op != VM_OP_LOCKED ? instr->base : instr->op;
+
+        vm_bool ok = _vmPerfRead(perf, &before);
+        vm_size_t step = _vmDispatchSlice(exec, 1, vm, ext);
+
+        if(ok && _vmPerfRead(perf, &after)){
+            _vmPerfAdd(perf->thread + exec->thread, &before, &after);
+            _vmPerfAdd(perf->op + op, &before, &after);
+        }
+        if(step > 0) perf->op_count[op]++;
+
+        done += step;
+        if(done > quantum) quantum = _vmSliceEnd(done, slice);
+        if(step == 0 || thread->wait || thread->lock || vm->halt || vm->suspend) break;
+    }
+    return done;
+}
+#endif
+
+// execute up to quantum instructions of one thread, returns executed count
+vm_size_t _vmExecSlice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+#ifdef VM_PERF
+    // counters follow the OS thread running TDM, slices of parallel workers aren't profiled
+    if(vm->perf != NULL && vm->perf->mode != VM_PERF_RUN && vm->sync == NULL) return _vmPerfSlice(exec, quantum, vm, ext);
+#endif
+    return _vmDispatchSlice(exec, quantum, vm, ext);
+}
+
+
+// restart sets pc of unlocked threads to 0, resumed threads go on from their pc
+vm_bool _vmExecInit(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, vm_bool restart){
+    vm->suspend = false;
+#ifdef VM_STATS
+    _vmStats(vm); // before parallel workers start
+#endif
+
+    for(vm_size_t i = 0; i < exec_count; i++){
+        VMThread* thread = &vm->thread[exec[i].thread];
+
+        if(exec[i].thread < vm->threads_count){
+            if(restart && thread->lock == false) thread->pc = 0;
+        }else{
+            vm->halt = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+// stops vmExecProgram / vmResumeProgram before the next instruction, safe from
+// an extension instruction, another thread or a signal handler
+void vmSuspend(VMInstance* vm){
+    vm->suspend = true;
+}
+
+// ready queues: finished and locked threads are dropped, waiting ones are parked on epoll
+// (or polled once a round when epoll is not available)
+#define VM_SCHED_EVENTS 64
+#define VM_SCHED_EPOLL_LAZY -2
+
+typedef struct VMReadyQueue{
+    vm_size_t* item; // exec indices
+    vm_size_t head, count;
+} VMReadyQueue;
+
+typedef struct VMSchedState{
+    VMReadyQueue ready[VM_SCHED_PRIORITIES];
+    VMReadyQueue wait;
+    vm_size_t capacity;
+
+    int epoll; // created when the first thread is parked, -1 if waiting threads are polled
+    vm_bool* parked; // per exec, socket is in the epoll set
+    vm_size_t parked_count;
+} VMSchedState;
+
+void _vmSchedPush(VMReadyQueue* queue, vm_size_t capacity, vm_size_t item){
+    queue->item[(queue->head + queue->count++) % capacity] = item;
+}
+vm_size_t _vmSchedPop(VMReadyQueue* queue, vm_size_t capacity){
+    vm_size_t item = queue->item[queue->head];
+    queue->head = (queue->head + 1) % capacity;
+    queue->count--;
+    return item;
+}
+
+vm_bool _vmSchedPark(VMSchedState* state, vm_size_t i, const VMThread* thread){
+#ifdef VM_HAS_EPOLL
+    if(state->epoll == VM_SCHED_EPOLL_LAZY) state->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(state->epoll < 0) return false;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = i};
+    if(epoll_ctl(state->epoll, EPOLL_CTL_ADD, thread->sock, &event) < 0) return false;
+
+    state->parked[i] = true;
+    state->parked_count++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// put thread to the queue matching its state
+void _vmSchedPlace(VMSchedState* state, const VMExec* exec, vm_size_t i, const VMInstance* vm){
+    const VMThread* thread = &vm->thread[exec[i].thread];
+
+    if(thread->pc >= exec[i].prog->size || thread->lock || state->parked[i]) return;
+
+    if(thread->wait){
+        if(!_vmSchedPark(state, i, thread)) _vmSchedPush(&state->wait, state->capacity, i);
+    }else{
+        vm_uint8_t cls = vm->sched.policy == VM_SCHED_PRIORITY ? thread->priority : 0;
+        _vmSchedPush(state->ready + cls, state->capacity, i);
+    }
+}
+
+// lock state changed: place all threads again, starting after the last one run
+void _vmSchedRebuild(VMSchedState* state, const VMExec* exec, vm_size_t exec_count, vm_size_t last, const VMInstance* vm){
+    for(vm_size_t c = 0; c < VM_SCHED_PRIORITIES; c++) state->ready[c].head = state->ready[c].count = 0;
+    state->wait.head = state->wait.count = 0;
+
+    for(vm_size_t i = 1; i <= exec_count; i++) _vmSchedPlace(state, exec, (last + i) % exec_count, vm);
+}
+
+VMReadyQueue* _vmSchedNext(VMSchedState* state){
+    for(vm_size_t c = VM_SCHED_PRIORITIES; c > 0; c--){
+        if(state->ready[c - 1].count > 0) return state->ready + c - 1;
+    }
+    return NULL;
+}
+
+// run one turn of thread and place it back
+void _vmSchedRun(VMSchedState* state, const VMExec* exec, vm_size_t exec_count, vm_size_t i, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    vm_size_t epoch = vm->sched.epoch;
+
+    _vmExecSlice(exec + i, quantum, vm, ext);
+
+    if(vm->sched.epoch != epoch) _vmSchedRebuild(state, exec, exec_count, i, vm);
+    else _vmSchedPlace(state, exec, i, vm);
+}
+
+// parked threads that can still be woken up, locked ones are never run again by TDM
+vm_bool _vmSchedParkedLive(const VMSchedState* state, const VMExec* exec, vm_size_t exec_count, const VMInstance* vm){
+    for(vm_size_t i = 0; state->parked_count > 0 && i < exec_count; i++){
+        if(state->parked[i] && !vm->thread[exec[i].thread].lock) return true;
+    }
+    return false;
+}
+
+// run threads whose sockets became readable, timeout -1 blocks until one does
+void _vmSchedWake(VMSchedState* state, const VMExec* exec, vm_size_t exec_count, int timeout, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+#ifdef VM_HAS_EPOLL
+    struct epoll_event events[VM_SCHED_EVENTS];
+    int count = epoll_wait(state->epoll, events, VM_SCHED_EVENTS, timeout);
+
+    for(int e = 0; e < count && !vm->halt && !vm->suspend; e++){
+        vm_size_t i = events[e].data.u64;
+
+        epoll_ctl(state->epoll, EPOLL_CTL_DEL, vm->thread[exec[i].thread].sock, NULL);
+        state->parked[i] = false;
+        state->parked_count--;
+
+        _vmSchedRun(state, exec, exec_count, i, quantum, vm, ext);
+    }
+#endif
+}
+
+// run threads until they end, wait forever, vm halts or is suspended
+void _vmSchedLoop(VMSchedState* state, const VMExec* exec, vm_size_t exec_count, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    vm_size_t turns = 0;
+
+    while(!vm->halt && !vm->suspend){
+        VMReadyQueue* ready = _vmSchedNext(state);
+        vm_bool idle = ready == NULL && state->wait.count == 0;
+
+        if(idle && !_vmSchedParkedLive(state, exec, exec_count, vm)) break;
+
+        if(ready != NULL){
+            _vmSchedRun(state, exec, exec_count, _vmSchedPop(ready, state->capacity), quantum, vm, ext);
+            turns++;
+        }
+
+        // wake or poll waiting threads once every ready thread had its turn
+        ready = _vmSchedNext(state);
+        if(ready != NULL && turns < ready->count) continue;
+        turns = 0;
+
+        for(vm_size_t n = state->wait.count; n > 0 && !vm->halt && !vm->suspend; n--){
+            _vmSchedRun(state, exec, exec_count, _vmSchedPop(&state->wait, state->capacity), quantum, vm, ext);
+        }
+
+        if(state->parked_count > 0){
+            idle = _vmSchedNext(state) == NULL && state->wait.count == 0;
+            _vmSchedWake(state, exec, exec_count, idle ? -1 : 0, quantum, vm, ext);
+        }
+    }
+}
+
+void _vmExecRun(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    // setup scheduler
+    vm_size_t quantum = vm->sched.quantum == 0 ? 1 : vm->sched.quantum;
+    if(vm->sched.policy == VM_SCHED_RUN_UNTIL_BLOCK || exec_count == 1) quantum = VM_SCHED_UNTIL_BLOCK; // lone thread has nothing to interleave with
+
+    VMSchedState state = {.capacity = exec_count, .epoll = -1, .parked_count = 0};
+    vm_size_t* items = malloc((VM_SCHED_PRIORITIES + 1) * exec_count * sizeof(vm_size_t));
+
+    for(vm_size_t c = 0; c < VM_SCHED_PRIORITIES; c++) state.ready[c].item = items + c * exec_count;
+    state.wait.item = items + VM_SCHED_PRIORITIES * exec_count;
+
+    state.parked = calloc(exec_count, sizeof(vm_bool));
+#ifdef VM_HAS_EPOLL
+    state.epoll = VM_SCHED_EPOLL_LAZY;
+#endif
+
+    _vmSchedRebuild(&state, exec, exec_count, exec_count - 1, vm);
+
+#ifdef VM_PERF
+    VMPerfCounts before, after;
+    vm_bool counted = vm->perf != NULL && _vmPerfRead(vm->perf, &before);
+#endif
+
+    // execute program, with VM_GUARDED_STACKS stack fault halts vm here
+    VM_FAULT_GUARD(vm, _vmSchedLoop(&state, exec, exec_count, quantum, vm, ext));
+
+#ifdef VM_PERF
+    if(counted && _vmPerfRead(vm->perf, &after)) _vmPerfAdd(&vm->perf->total, &before, &after);
+#endif
+
+    // release
+#ifdef VM_HAS_EPOLL
+    if(state.epoll >= 0) close(state.epoll);
+#endif
+    free(state.parked);
+    free(items);
+}
+
+void vmExecProgram(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    // init threads
+    if(!_vmExecInit(exec, exec_count, vm, true) || exec_count == 0) return;
+
+    _vmExecRun(exec, exec_count, vm, ext);
+}
+
+// goes on after vmSuspend or vmRestore, every thread starts from its pc
+void vmResumeProgram(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext){
+    if(!_vmExecInit(exec, exec_count, vm, false) || exec_count == 0) return;
+
+    _vmExecRun(exec, exec_count, vm, ext);
+}
+
+#ifdef VM_STATS
+// counts of the instance up to now, icode counts are gathered from all threads
+// (NULL if out of memory), valid until the next run or vmResetStats / vmReleaseInstance
+const VMStats* vmGetStats(VMInstance* vm){
+    VMStats* stats = _vmStats(vm);
+    if(stats == NULL) return NULL;
+
+    free(stats->icode);
+    stats->icode = NULL;
+    stats->icode_count = 0;
+    stats->turns = _vmStatsTurns(stats);
+
+    for(vm_size_t i = 0; i < stats->threads_count; i++){
+        const VMThreadStats* thread = stats->thread + i;
+
+        for(vm_size_t j = 0; j < thread->icode_count; j++) _vmIcodeAdd(&stats->icode, &stats->icode_count, thread->icode[j].icode, thread->icode[j].count);
+        for(vm_size_t pc = 0; pc < thread->pc_size; pc++){
+            if(thread->pc[pc] > 0) _vmIcodeAdd(&stats->icode, &stats->icode_count, thread->pc_icode[pc], thread->pc[pc]);
+        }
+    }
+    return stats;
+}
+
+// all counts to zero, threads keep their pc tables
+void vmResetStats(VMInstance* vm){
+    VMStats* stats = vm->stats;
+    if(stats == NULL) return;
+
+    for(vm_size_t i = 0; i < stats->threads_count; i++){
+        VMThreadStats* thread = stats->thread + i;
+
+        thread->executed = thread->slices = thread->waits = thread->locked = thread->halts = 0;
+        thread->locked_at = 0;
+        if(thread->pc != NULL) memset(thread->pc, 0, thread->pc_size * sizeof(vm_size_t));
+
+        free(thread->icode);
+        thread->icode = NULL;
+        thread->icode_count = 0;
+    }
+
+    free(stats->icode);
+    stats->icode = NULL;
+    stats->icode_count = 0;
+    stats->turns = 0;
+}
+
+uint32_t _vmIcodeValue(vm_uint32_t icode){
+    return (uint32_t)icode.bytes[0] << 24 | (uint32_t)icode.bytes[1] << 16 | (uint32_t)icode.bytes[2] << 8 | icode.bytes[3];
+}
+
+// writes counts of threads, executed pcs and icodes, false if out can't be written
+vm_bool vmWriteStats(VMInstance* vm, FILE* out, VM_STATS_FORMAT format){
+    const VMStats* stats = vmGetStats(vm);
+    if(stats == NULL) return false;
+
+    if(format == VM_STATS_CSV) fprintf(out, "kind,thread,key,count\n");
+    else fprintf(out, "turns: %zu\n", (size_t)stats->turns);
+
+    for(vm_size_t i = 0; i < stats->threads_count; i++){
+        const VMThreadStats* thread = stats->thread + i;
+        const char* key[5] = {"executed", "slices", "waits", "locked", "halts"};
+        vm_size_t value[5] = {thread->executed, thread->slices, thread->waits, thread->locked, thread->halts};
+
+        if(format == VM_STATS_CSV){
+            for(vm_size_t k = 0; k < 5; k++) fprintf(out, "thread,%zu,%s,%zu\n", (size_t)i, key[k], (size_t)value[k]);
+        }else fprintf(out, "thread %zu: executed %zu, slices %zu, waits %zu, locked %zu, halts %zu\n", (size_t)i,
+            (size_t)value[0], (size_t)value[1], (size_t)value[2], (size_t)value[3], (size_t)value[4]);
+
+        for(vm_size_t pc = 0; pc < thread->pc_size; pc++){
+            if(thread->pc[pc] == 0) continue;
+
+            if(format == VM_STATS_CSV) fprintf(out, "pc,%zu,%zu,%zu\n", (size_t)i, (size_t)pc, (size_t)thread->pc[pc]);
+            else fprintf(out, "    pc %zu: %zu\n", (size_t)pc, (size_t)thread->pc[pc]);
+        }
+    }
+
+    for(vm_size_t i = 0; i < stats->icode_count; i++){
+        const VMInstructionDescriptor* desc = vmFindInstruction(&stats->icode[i].icode, NULL);
+        uint32_t icode = _vmIcodeValue(stats->icode[i].icode);
+
+        if(format == VM_STATS_CSV) fprintf(out, "icode,,0x%08x,%zu\n", (unsigned)icode, (size_t)stats->icode[i].count);
+        else fprintf(out, "icode 0x%08x %s: %zu\n", (unsigned)icode, desc != NULL && desc->alias != NULL ? desc->alias : "ext", (size_t)stats->icode[i].count);
+    }
+
+    return ferror(out) == 0;
+}
+#endif
+
+#ifdef VM_PERF
+// counts since vmPerfStart, NULL if the instance isn't profiled
+const VMPerf* vmGetPerf(const VMInstance* vm){
+    return vm->perf;
+}
+
+void _vmPerfWriteCounts(FILE* out, const VMPerf* perf, const VMPerfCounts* counts){
+    static const char* const name[VM_PERF_EVENTS] = {"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "task-clock-ns"};
+
+    for(vm_size_t i = 0; i < VM_PERF_EVENTS; i++){
+        if(perf->fd[i] >= 0) fprintf(out, " %s %llu", name[i], (unsigned long long)counts->value[i]);
+    }
+    if(perf->fd[VM_PERF_CYCLES] >= 0 && perf->fd[VM_PERF_INSTRUCTIONS] >= 0 && counts->value[VM_PERF_CYCLES] > 0){
+        fprintf(out, " ipc %.2f", (double)counts->value[VM_PERF_INSTRUCTIONS] / counts->value[VM_PERF_CYCLES]);
+    }
+    fprintf(out, "\n");
+}
+
+// writes counts of runs, threads and opcodes, false if vm isn't profiled or out can't be written
+vm_bool vmWritePerf(const VMInstance* vm, FILE* out){
+    const VMPerf* perf = vm->perf;
+    if(perf == NULL) return false;
+
+    fprintf(out, "total:");
+    _vmPerfWriteCounts(out, perf, &perf->total);
+
+    for(vm_size_t i = 0; perf->thread != NULL && i < perf->threads_count; i++){
+        fprintf(out, "thread %zu:", (size_t)i);
+        _vmPerfWriteCounts(out, perf, perf->thread + i);
+    }
+
+    for(vm_size_t op = 0; perf->op != NULL && op < VM_OPCODES_COUNT; op++){
+        if(perf->op_count[op] == 0) continue;
+
+        const VMInstructionDescriptor* desc = op != VM_OP_EXT ? _vmOpDescriptor(op) : NULL;
+        fprintf(out, "op %zu %s: executed %llu", (size_t)op, desc != NULL ? desc->alias : "ext", (unsigned long long)perf->op_count[op]);
+        _vmPerfWriteCounts(out, perf, perf->op + op);
+    }
+
+    return ferror(out) == 0;
+}
+#endif
+
+// checkpoints: header, exec table and snapshot image at a page aligned offset,
+// stacks are mapped from the file by vmRestore, only used parts of them are written
+#define VM_CHECKPOINT_MAGIC 0x434d564e // "NVMC"
+#define VM_CHECKPOINT_VERSION 1
+
+// build options changing the image
+#define VM_CHECKPOINT_LE_REGISTERS 1
+#define VM_CHECKPOINT_THREAD_REGISTERS 2
+#define VM_CHECKPOINT_GUARDED_STACKS 4
+
+uint32_t _vmCheckpointLayout(){
+    uint32_t result = 0;
+#ifdef VM_REGISTERS_LE
+    result |= VM_CHECKPOINT_LE_REGISTERS;
+#endif
+#ifdef VM_THREAD_REGISTERS
+    result |= VM_CHECKPOINT_THREAD_REGISTERS;
+#endif
+#ifdef VM_GUARDED_STACKS
+    result |= VM_CHECKPOINT_GUARDED_STACKS;
+#endif
+    return result;
+}
+
+typedef struct VMCheckpointHeader{
+    uint32_t magic, version;
+    uint32_t layout; // VM_CHECKPOINT_* options of the build
+    uint32_t size_width, thread_size; // sizeof(vm_size_t), sizeof(VMThread)
+
+    uint64_t threads_count, exec_count;
+    uint64_t sc[6], se[6]; // from 256 to 8 bits
+    uint64_t stack_size;
+    uint64_t sched_policy, sched_quantum;
+
+    uint64_t arena_size;
+    uint64_t image_offset, image_size;
+
+    vm_r256 registers[4];
+    vm_uint32_t ip;
+    vm_uint16_t port;
+    vm_bool halt;
+} VMCheckpointHeader;
+
+typedef struct VMCheckpointExec{
+    uint64_t thread;
+    uint64_t prog_size; // checked against the program given to vmRestore
+} VMCheckpointExec;
+
+vm_bool _vmWriteAt(int fd, vm_size_t offset, const void* data, vm_size_t bytes){
+    if(bytes == 0) return true;
+    if(lseek(fd, offset, SEEK_SET) < 0) return false;
+
+    for(vm_size_t done = 0; done < bytes;){
+        ssize_t n = write(fd, (const vm_uint8_t*)data + done, bytes - done);
+        if(n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+vm_bool _vmReadAt(int fd, vm_size_t offset, void* data, vm_size_t bytes){
+    if(lseek(fd, offset, SEEK_SET) < 0) return false;
+
+    for(vm_size_t done = 0; done < bytes;){
+        ssize_t n = read(fd, (vm_uint8_t*)data + done, bytes - done);
+        if(n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// writes vm suspended or finished by vmExecProgram / vmResumeProgram, false if the file can't be written
+vm_bool vmCheckpoint(const char* path, const VMInstance* vm, const VMExec* exec, vm_size_t exec_count){
+    vm_uint8_t* stack[6];
+    vm_size_t bytes[6], used[6];
+    _vmStackParts(vm, stack, bytes, used);
+
+    VMCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = VM_CHECKPOINT_MAGIC;
+    header.version = VM_CHECKPOINT_VERSION;
+    header.layout = _vmCheckpointLayout();
+    header.size_width = sizeof(vm_size_t);
+    header.thread_size = sizeof(VMThread);
+
+    header.threads_count = vm->threads_count;
+    header.exec_count = exec_count;
+    for(vm_size_t i = 0; i < 6; i++){
+        header.sc[i] = bytes[i] / (32 >> i);
+        header.se[i] = used[i] / (32 >> i);
+    }
+    header.stack_size = vm->stack_size;
+    header.sched_policy = vm->sched.policy;
+    header.sched_quantum = vm->sched.quantum;
+
+    header.arena_size = vmInstanceArenaSize(vm->threads_count, _vmStacksOf(vm));
+    header.image_offset = _vmPageBytes(sizeof(header) + exec_count * sizeof(VMCheckpointExec));
+    header.image_size = _vmPageBytes(header.arena_size);
+#ifdef VM_GUARDED_STACKS
+    for(vm_size_t i = 0; i < 6; i++) header.image_size += bytes[i];
+#endif
+
+    memcpy(header.registers, &vm->r0, sizeof(header.registers));
+    header.ip = vm->ip;
+    header.port = vm->port;
+    header.halt = vm->halt;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+
+    vm_bool result = _vmWriteAt(fd, 0, &header, sizeof(header));
+
+    for(vm_size_t i = 0; i < exec_count && result; i++){
+        VMCheckpointExec entry = {.thread = exec[i].thread, .prog_size = exec[i].prog->size};
+        result = _vmWriteAt(fd, sizeof(header) + i * sizeof(entry), &entry, sizeof(entry));
+    }
+
+    // image, never written parts of it read back as zeros
+    if(result && vm->threads_count > 0) result = _vmWriteAt(fd, header.image_offset, vm->thread, vm->threads_count * sizeof(VMThread));
+
+#ifdef VM_GUARDED_STACKS
+    vm_size_t offset = _vmPageBytes(header.arena_size);
+#endif
+    for(vm_size_t i = 0; i < 6 && result; i++){
+#ifdef VM_GUARDED_STACKS
+        vm_size_t at = offset;
+        offset += bytes[i];
+#else
+        vm_size_t at = stack[i] - (vm_uint8_t*)vm->arena;
+#endif
+        if(stack[i] != NULL) result = _vmWriteAt(fd, header.image_offset + at, stack[i], used[i]);
+    }
+
+    // whole image is in the file, so it can be mapped
+    vm_uint8_t end = 0;
+    if(result && header.image_size > 0) result = _vmWriteAt(fd, header.image_offset + header.image_size - 1, &end, 1);
+
+    if(close(fd) < 0) result = false;
+    return result;
+}
+
+// arena, stacks and image of the header agree with each other and the image is in the file,
+// so restoring never writes past the arena or maps past the end of the file
+vm_bool _vmCheckpointFits(int fd, const VMCheckpointHeader* header){
+    const uint64_t max = (vm_size_t)-1;
+    struct stat st;
+
+    if(fstat(fd, &st) != 0 || st.st_size < 0) return false;
+    // sizes below can't overflow: threads take at most half of vm_size_t, stacks 6 / 16 of it
+    if(header->threads_count > max / 2 / sizeof(VMThread)) return false;
+
+    for(vm_size_t i = 0; i < 6; i++){
+        if(header->sc[i] > max / 16 / (32 >> i) || header->se[i] > header->sc[i]) return false;
+    }
+
+    VMStacks stacks = {
+        .s256 = header->sc[0], .s128 = header->sc[1], .s64 = header->sc[2],
+        .s32 = header->sc[3], .s16 = header->sc[4], .s8 = header->sc[5]
+    };
+    if(header->arena_size != vmInstanceArenaSize(header->threads_count, stacks)) return false;
+
+    uint64_t image_size = _vmPageBytes(header->arena_size);
+#ifdef VM_GUARDED_STACKS
+    for(vm_size_t i = 0; i < 6; i++) image_size += header->sc[i] * (32 >> i);
+#endif
+
+    uint64_t file_size = (uint64_t)st.st_size;
+    return header->image_size == image_size
+        && header->image_offset % _vmPageSize() == 0
+        && header->image_offset <= file_size && header->image_size <= file_size - header->image_offset;
+}
+
+// instance on ip / port continuing the checkpoint, exec gets threads of the checkpoint
+// and keeps its programs, the instance is halted if the file doesn't match this build
+// or the programs (every exec needs one)
+VMInstance vmRestore(const char* path, VMExec* exec, vm_size_t exec_count, vm_uint32_t ip, vm_uint16_t port){
+    VMInstance failed = {.halt = true, .ip = ip, .port = port};
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return failed; // do some exception here
+
+    VMCheckpointHeader header;
+    vm_bool ok = _vmReadAt(fd, 0, &header, sizeof(header))
+        && header.magic == VM_CHECKPOINT_MAGIC
+        && header.version == VM_CHECKPOINT_VERSION
+        && header.layout == _vmCheckpointLayout()
+        && header.size_width == sizeof(vm_size_t)
+        && header.thread_size == sizeof(VMThread)
+        && header.exec_count == exec_count;
+
+    for(vm_size_t i = 0; i < exec_count && ok; i++){
+        VMCheckpointExec entry;
+        ok = _vmReadAt(fd, sizeof(header) + i * sizeof(entry), &entry, sizeof(entry))
+            && entry.thread < header.threads_count
+            && exec[i].prog != NULL && exec[i].prog->size == entry.prog_size;
+
+        if(ok) exec[i].thread = entry.thread;
+    }
+
+    ok = ok && _vmCheckpointFits(fd, &header);
+
+    if(!ok){
+        // do some exception here
+        close(fd);
+        return failed;
+    }
+
+    // checkpoint is a snapshot image in a file, forks map everything from it
+    VMSnapshot snap = {
+        .vm = {
+            .threads_count = header.threads_count,
+            .sc256 = header.sc[0], .sc128 = header.sc[1], .sc64 = header.sc[2],
+            .sc32 = header.sc[3], .sc16 = header.sc[4], .sc8 = header.sc[5],
+            .se256 = header.se[0], .se128 = header.se[1], .se64 = header.se[2],
+            .se32 = header.se[3], .se16 = header.se[4], .se8 = header.se[5],
+            .stack_size = header.stack_size,
+            .halt = header.halt,
+            .sched = {.policy = (VM_SCHED_POLICY)header.sched_policy, .quantum = header.sched_quantum}
+        },
+        .arena_size = header.arena_size,
+        .size = header.image_size,
+        .fd = fd,
+        .offset = header.image_offset,
+        .image = NULL,
+        .copy_max = 0
+    };
+    memcpy(&snap.vm.r0, header.registers, sizeof(header.registers));
+
+    VMInstance result = vmFork(&snap, ip, port);
+    close(fd);
+
+    return result;
+}
+
+#ifdef VM_TRACE
+// writes the trace of vm to path, false if it isn't traced or the file can't be written
+vm_bool vmTraceWrite(const VMInstance* vm, const char* path){
+    const VMTrace* trace = vm->trace;
+    if(trace == NULL) return false;
+
+    uint64_t capacity = trace->mask + 1;
+    uint64_t head = trace->head;
+    VMTraceHeader header = {
+        .magic = VM_TRACE_MAGIC,
+        .version = VM_TRACE_VERSION,
+        .record_size = sizeof(VMTraceRecord),
+        .count = head < capacity ? head : capacity,
+        .lost = head < capacity ? 0 : head - capacity,
+        .tsc_start = trace->tsc_start,
+        .ns_start = trace->ns_start,
+        .tsc_end = _vmTraceClock(),
+        .ns_end = _vmTraceNs()
+    };
+#ifdef VM_HAS_TSC
+    header.tsc = 1;
+#endif
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+
+    // oldest records are right after the newest one once the ring is full
+    uint64_t first = head < capacity ? 0 : head & trace->mask;
+    vm_size_t tail = (capacity - first) * sizeof(VMTraceRecord);
+    vm_bool ok = _vmWriteAt(fd, 0, &header, sizeof(header));
+
+    if(head < capacity) ok = ok && _vmWriteAt(fd, sizeof(header), trace->record, head * sizeof(VMTraceRecord));
+    else{
+        ok = ok && _vmWriteAt(fd, sizeof(header), trace->record + first, tail)
+            && _vmWriteAt(fd, sizeof(header) + tail, trace->record, first * sizeof(VMTraceRecord));
+    }
+
+    return close(fd) == 0 && ok;
+}
+#endif
+
+
+
+// offsets of instruction at are taken from the start of bytecode
+VMParser _vmParseInstruction(const vm_uint8_t* bytecode, const vm_uint8_t* at, const VMInstructionDescriptor* desc){
+    VMParser result = {
+        .instr = {.desc = VM_DESC_NONE, .op = VM_OP_EXT},
+        .desc = desc,
+        .next = at
+    };
+
+    if(desc != NULL){
+        result.instr.icode = at - bytecode;
+        result.instr.op = _vmOpcode(desc);
+
+        switch (desc->itype){
+        case FREE:
+            result.next = at + sizeof(vm_uint32_t);
+            return result;
+            break;
         case SINGLE:
-            result.instr.op0 = bytecode + sizeof(vm_uint32_t);
-            result.next = bytecode + sizeof(vm_uint32_t) + desc->op0_size;
+            result.next = at + sizeof(vm_uint32_t) + desc->op0_size;
             return result;
             break;
         case DOUBLE:
-            result.instr.op0 = bytecode + sizeof(vm_uint32_t);
-            result.instr.op1 = bytecode + sizeof(vm_uint32_t) + desc->op0_size;
-            result.next = bytecode + sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size;
+            result.instr.op1 = sizeof(vm_uint32_t) + desc->op0_size;
+            result.next = at + sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size;
             return result;
         case TRIPLE:
-            result.instr.op0 = bytecode + sizeof(vm_uint32_t);
-            result.instr.op1 = bytecode + sizeof(vm_uint32_t) + desc->op0_size;
-            result.instr.op2 = bytecode + sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size;
-            result.next = bytecode + sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size + desc->op2_size;
+            result.instr.op1 = sizeof(vm_uint32_t) + desc->op0_size;
+            result.instr.op2 = sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size;
+            result.next = at + sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size + desc->op2_size;
             return result;
         default:
             break;
         }
     }
 
+    result.desc = NULL;
     return result;
 }
 
-VMProgram vmParseProgram(const vm_uint8_t* bytecode, vm_size_t prog_size, const VMInstructionDescriptorsExt* ext){
+VMParser vmParseInstruction(const vm_uint8_t* bytecode, const VMInstructionDescriptorsExt* ext){
+    return _vmParseInstruction(bytecode, bytecode, vmFindInstruction((vm_uint32_t*)bytecode, ext));
+}
+
+// index of extension descriptor in the program, added on first use
+uint32_t _vmProgramDesc(VMProgram* prog, const VMInstructionDescriptor* desc){
+    for(vm_size_t i = 0; i < prog->desc_count; i++){
+        if(prog->desc[i] == desc) return i;
+    }
+
+    const VMInstructionDescriptor** grown = realloc(prog->desc, (prog->desc_count + 1) * sizeof(*grown));
+    if(grown == NULL) return VM_DESC_NONE; // do some exception here
+
+    prog->desc = grown;
+    prog->desc[prog->desc_count] = desc;
+    return prog->desc_count++;
+}
+
+// bytecode is copied, it can be released after parsing; program is NULL if nothing could be
+// parsed: reg has two descriptors of some icode (it isn't known which one the bytecode means)
+// or there is no memory, an empty bytecode still gives a program
+VMProgram vmParseProgramRegistry(const vm_uint8_t* bytecode, vm_size_t prog_size, const VMInstructionRegistry* reg){
     VMProgram result = {.size = 0};
-    result.program = malloc(prog_size * sizeof(VMInstruction));
+    if(reg->collision) return result;
+
+    result.program = malloc((prog_size > 0 ? prog_size : 1) * sizeof(VMInstruction));
+    if(result.program == NULL) return result;
+
+    const vm_uint8_t* end = bytecode;
+    VMParser parser = _vmParseInstruction(bytecode, bytecode, vmRegistryFind(reg, (vm_uint32_t*)bytecode));
 
-    VMParser parser = vmParseInstruction(bytecode, ext);
+    while(parser.desc != NULL && result.size < prog_size){
+        if(parser.instr.op == VM_OP_EXT) parser.instr.desc = _vmProgramDesc(&result, parser.desc);
 
-    while(parser.instr.icode != NULL && result.size < prog_size){
         result.program[result.size++] = parser.instr;
-        parser = vmParseInstruction(parser.next, ext);
+        end = parser.next;
+
+        if(result.size < prog_size) parser = _vmParseInstruction(bytecode, parser.next, vmRegistryFind(reg, (vm_uint32_t*)parser.next));
     }
 
     if(result.size != prog_size) ; // do some exception here
 
+    result.code_size = end - bytecode;
+    result.code = malloc(result.code_size);
+    if(result.code_size > 0) memcpy((void*)result.code, bytecode, result.code_size);
+
+    return result;
+}
+
+VMProgram vmParseProgram(const vm_uint8_t* bytecode, vm_size_t prog_size, const VMInstructionDescriptorsExt* ext){
+    VMInstructionRegistry reg = vmInstructionRegistry(ext);
+    VMProgram result = vmParseProgramRegistry(bytecode, prog_size, &reg);
+
+    vmReleaseInstructionRegistry(&reg);
+    return result;
+}
+
+
+// verifier
+// register class of an operand: 0 for r8 ... 5 for r256, -1 for wrong register
+int _vmRegisterClass(vm_uint8_t reg){
+    if(VM_R8_INDEX_INBOUNDS(reg)) return 0;
+    if(VM_R16_INDEX_INBOUNDS(reg)) return 1;
+    if(VM_R32_INDEX_INBOUNDS(reg)) return 2;
+    if(VM_R64_INDEX_INBOUNDS(reg)) return 3;
+    if(VM_R128_INDEX_INBOUNDS(reg)) return 4;
+    if(VM_R256_INDEX_INBOUNDS(reg)) return 5;
+    return -1;
+}
+
+// unchecked form of instruction, VM_OP_EXT if there is none and VM_OPCODES_COUNT if it is wrong
+VM_OPCODE _vmVerifyInstruction(const VMProgram* prog, const VMInstruction* instr){
+    const vm_uint8_t* op0 = VM_OPERAND(prog->code, instr, 0);
+    const vm_uint8_t* op1 = VM_OPERAND(prog->code, instr, 1);
+    vm_size_t prog_size = prog->size;
+    int cls;
+
+    if(instr->op == VM_OP_EXT && instr->desc >= prog->desc_count) return VM_OPCODES_COUNT;
+
+    switch(instr->op){
+    case VM_OP_GO_ADR:
+        return vm_ui32_to_size_t(*(const vm_uint32_t*)op0) < prog_size ? VM_OP_GO_PC : VM_OPCODES_COUNT;
+    case VM_OP_GO_R:
+        return _vmRegisterClass(*op0) == 5 ? VM_OP_GO_R256 : VM_OPCODES_COUNT;
+
+    case VM_OP_SND_R_R:
+        cls = _vmRegisterClass(*op0);
+        return cls >= 0 && cls == _vmRegisterClass(*op1) ? (VM_OPCODE)(VM_OP_SND_R8_R8 + cls) : VM_OPCODES_COUNT;
+    case VM_OP_SND_NUM_R8: case VM_OP_SND_NUM_R16: case VM_OP_SND_NUM_R32:
+    case VM_OP_SND_NUM_R64: case VM_OP_SND_NUM_R128: case VM_OP_SND_NUM_R256:
+        cls = instr->op - VM_OP_SND_NUM_R8;
+        return _vmRegisterClass(*op1) == cls ? (VM_OPCODE)(VM_OP_SND_NUM8_R8 + cls) : VM_OPCODES_COUNT;
+
+    case VM_OP_PUSH8_NUM: case VM_OP_PUSH16_NUM: case VM_OP_PUSH32_NUM:
+    case VM_OP_PUSH64_NUM: case VM_OP_PUSH128_NUM: case VM_OP_PUSH256_NUM:
+        return (VM_OPCODE)(VM_OP_PUSH8_IMM + instr->op - VM_OP_PUSH8_NUM);
+
+    case VM_OP_PUSH8_R: case VM_OP_PUSH16_R: case VM_OP_PUSH32_R:
+    case VM_OP_PUSH64_R: case VM_OP_PUSH128_R: case VM_OP_PUSH256_R:
+        cls = instr->op - VM_OP_PUSH8_R;
+        return _vmRegisterClass(*op0) == cls ? (VM_OPCODE)(VM_OP_PUSH8_R8 + cls) : VM_OPCODES_COUNT;
+    case VM_OP_POP8: case VM_OP_POP16: case VM_OP_POP32:
+    case VM_OP_POP64: case VM_OP_POP128: case VM_OP_POP256:
+        cls = instr->op - VM_OP_POP8;
+        return _vmRegisterClass(*op0) == cls ? (VM_OPCODE)(VM_OP_POP8_R8 + cls) : VM_OPCODES_COUNT;
+
+    case VM_OP_INC_R_R: case VM_OP_DEC_R_R:
+        cls = _vmRegisterClass(*op0);
+        if(cls < 0 || cls != _vmRegisterClass(*op1)) return VM_OPCODES_COUNT;
+        return (VM_OPCODE)((instr->op == VM_OP_INC_R_R ? VM_OP_INC_R8_R8 : VM_OP_DEC_R8_R8) + cls);
+
+    case VM_OP_ASK:
+        return VM_OP_ASK_ADR;
+
+    case VM_OP_SEND_R:
+        return _vmRegisterClass(*op1) >= 0 ? VM_OP_EXT : VM_OPCODES_COUNT;
+    case VM_OP_RECV_R:
+        return _vmRegisterClass(*op0) >= 0 ? VM_OP_EXT : VM_OPCODES_COUNT;
+
+    case VM_OP_LDS: case VM_OP_STS:
+        cls = _vmRegisterClass(*op0);
+        return cls >= 0 && cls == _vmRegisterClass(*op1) ? VM_OP_EXT : VM_OPCODES_COUNT;
+
+    default:
+        return VM_OP_EXT; // no operands to check or decode, extensions or already verified
+    }
+}
+
+// byte offset of a verified register in the register file
+uint8_t _vmRegisterOffset(vm_uint8_t reg){
+    VMRegisters regs; // only for addresses
+
+    switch(_vmRegisterClass(reg)){
+    case 0: return (vm_uint8_t*)&VM_R8(reg - VM_R8_END, regs) - (vm_uint8_t*)&regs.r0;
+    case 1: return (vm_uint8_t*)&VM_R16(reg - VM_R16_END, regs) - (vm_uint8_t*)&regs.r0;
+    case 2: return (vm_uint8_t*)&VM_R32(reg - VM_R32_END, regs) - (vm_uint8_t*)&regs.r0;
+    case 3: return (vm_uint8_t*)&VM_R64(reg - VM_R64_END, regs) - (vm_uint8_t*)&regs.r0;
+    case 4: return (vm_uint8_t*)&VM_R128(reg - VM_R128_END, regs) - (vm_uint8_t*)&regs.r0;
+    default: return (vm_uint8_t*)&VM_R256(reg - VM_R256_END, regs) - (vm_uint8_t*)&regs.r0;
+    }
+}
+
+// pool grows by powers of two, entries are aligned for any number or address
+vm_size_t _vmPoolCapacity(vm_size_t size){
+    vm_size_t result = 64;
+    while(result < size) result *= 2;
+    return result;
+}
+
+// offset of bytes taken from pool of the program, VM_DESC_NONE if it can't grow
+uint32_t _vmPoolTake(VMProgram* prog, vm_size_t bytes){
+    vm_size_t offset = (prog->pool_size + 15) / 16 * 16;
+    vm_size_t capacity = prog->pool_size > 0 ? _vmPoolCapacity(prog->pool_size) : 0;
+
+    if(offset + bytes > capacity){
+        vm_uint8_t* pool = realloc(prog->pool, _vmPoolCapacity(offset + bytes));
+        if(pool == NULL) return VM_DESC_NONE;
+
+        prog->pool = pool;
+    }
+
+    prog->pool_size = offset + bytes;
+    return offset;
+}
+
+// number in registers byte order, inline or in pool
+vm_bool _vmDecodeNumber(VMProgram* prog, VMInstruction* instr, const void* num, vm_size_t size){
+    if(size <= sizeof(instr->imm)){
+        instr->imm = 0;
+        _vm_reg_from_num(&instr->imm, num, size);
+        return true;
+    }
+
+    uint32_t offset = _vmPoolTake(prog, size);
+    if(offset == VM_DESC_NONE) return false;
+
+    _vm_reg_from_num(prog->pool + offset, num, size);
+    instr->pool = offset;
+    return true;
+}
+
+// switches verified instruction to unchecked form op with decoded operands,
+// instruction is left as it is if pool can't grow
+void _vmDecodeInstruction(VMProgram* prog, VMInstruction* instr, VM_OPCODE op){
+    const vm_uint8_t* op0 = VM_OPERAND(prog->code, instr, 0);
+    const vm_uint8_t* op1 = VM_OPERAND(prog->code, instr, 1);
+    VMInstruction result = *instr;
+
+    result.op = op;
+    result.imm = 0;
+
+    if(op == VM_OP_GO_PC){
+        result.imm = vm_ui32_to_size_t(*(const vm_uint32_t*)op0);
+    }else if(op == VM_OP_ASK_ADR){
+        uint32_t offset = _vmPoolTake(prog, sizeof(struct sockaddr_in));
+        if(offset == VM_DESC_NONE) return;
+
+        struct sockaddr_in adr = _vmNetAddress((const vm_uint64_t*)op0);
+        memcpy(prog->pool + offset, &adr, sizeof(adr));
+        result.pool = offset;
+    }else if(op >= VM_OP_PUSH8_IMM && op <= VM_OP_PUSH256_IMM){
+        if(!_vmDecodeNumber(prog, &result, op0, (vm_size_t)1 << (op - VM_OP_PUSH8_IMM))) return;
+    }else if(op >= VM_OP_SND_NUM8_R8 && op <= VM_OP_SND_NUM256_R256){
+        if(!_vmDecodeNumber(prog, &result, op0, (vm_size_t)1 << (op - VM_OP_SND_NUM8_R8))) return;
+        result.r1 = _vmRegisterOffset(*op1);
+    }else{
+        // go r256, push / pop have one register, snd / inc / dec two
+        result.r0 = _vmRegisterOffset(*op0);
+        if(_vmOpDescriptor(op)->itype == DOUBLE) result.r1 = _vmRegisterOffset(*op1);
+    }
+
+    *instr = result;
+}
+
+// checks register classes, number sizes and static go targets once and switches
+// instructions to unchecked handlers on decoded operands, wrong program is left as it is
+vm_bool vmVerifyProgram(VMProgram* prog, vm_size_t* wrong_pc){
+    for(vm_size_t i = 0; i < prog->size; i++){
+        if(_vmVerifyInstruction(prog, prog->program + i) == VM_OPCODES_COUNT){
+            if(wrong_pc != NULL) *wrong_pc = i;
+            return false;
+        }
+    }
+
+    for(vm_size_t i = 0; i < prog->size; i++){
+        VM_OPCODE op = _vmVerifyInstruction(prog, prog->program + i);
+        if(op != VM_OP_EXT) _vmDecodeInstruction(prog, prog->program + i, op);
+    }
+    return true;
+}
+
+
+// superinstructions: sequences of verified instructions run by one handler
+#ifndef VM_FUSE_MAX
+#define VM_FUSE_MAX 16 // instructions in an inc run or a locked section
+#endif
+
+// register and stack instructions allowed in a locked section
+vm_bool _vmFuseLockable(VM_OPCODE op){
+    return (op >= VM_OP_SND_R8_R8 && op <= VM_OP_DEC_R256_R256) || (op >= VM_OP_PUSH8_IMM && op <= VM_OP_PUSH256_IMM);
+}
+
+// fused form of the sequence at instr or instr itself, next is the end of program
+VMInstruction _vmFuseAt(const VMInstruction* instr, const VMInstruction* end){
+    VMInstruction result = *instr;
+    VM_OPCODE op = (VM_OPCODE)instr->op;
+    const VMInstruction* next = instr + 1;
+    vm_size_t length = end - instr;
+
+    result.base = op;
+
+    if(op == VM_OP_LOCK){
+        // lock; register and stack instructions; unlock
+        vm_size_t n = 1;
+        while(n < length && n < VM_FUSE_MAX - 1 && _vmFuseLockable((VM_OPCODE)instr[n].op)) n++;
+
+        if(n > 1 && n < length && instr[n].op == VM_OP_UNLOCK){
+            result.op = VM_OP_LOCKED;
+            result.imm = n + 1;
+        }
+    }else if(length < 2){
+        ;
+    }else if(op >= VM_OP_INC_R8_R8 && op <= VM_OP_INC_R256_R256 && instr->r0 == instr->r1){
+        // inc a, a repeated
+        vm_size_t n = 1;
+        while(n < length && n < VM_FUSE_MAX && instr[n].op == op && instr[n].r0 == instr->r0 && instr[n].r1 == instr->r0) n++;
+
+        if(n > 1){
+            result.op = VM_OP_INC_RUN8 + (op - VM_OP_INC_R8_R8);
+            result.imm = n;
+        }
+    }else if(op >= VM_OP_SND_NUM8_R8 && op <= VM_OP_SND_NUM256_R256){
+        // snd num, a; inc a, b
+        if(next->op == VM_OP_INC_R8_R8 + (op - VM_OP_SND_NUM8_R8) && next->r0 == instr->r1){
+            result.op = VM_OP_SND_INC8 + (op - VM_OP_SND_NUM8_R8);
+            result.r0 = next->r1;
+        }
+    }else if(op >= VM_OP_PUSH8_R8 && op <= VM_OP_PUSH256_R256){
+        // push a; pop b
+        if(next->op == VM_OP_POP8_R8 + (op - VM_OP_PUSH8_R8)){
+            result.op = VM_OP_PUSH_POP8 + (op - VM_OP_PUSH8_R8);
+            result.r1 = next->r0;
+        }
+    }else if(op >= VM_OP_POP8_R8 && op <= VM_OP_POP256_R256){
+        // pop a; push a
+        if(next->op == VM_OP_PUSH8_R8 + (op - VM_OP_POP8_R8) && next->r0 == instr->r0){
+            result.op = VM_OP_POP_PUSH8 + (op - VM_OP_POP8_R8);
+        }
+    }
+
+    return result;
+}
+
+// replaces instructions of verified program with superinstructions where a sequence matches,
+// covered instructions stay in place for go and resumed threads, returns count of superinstructions
+vm_size_t vmFuseProgram(VMProgram* prog){
+    vm_size_t result = 0;
+
+    for(vm_size_t i = 0; i < prog->size; i++){
+        VMInstruction fused = _vmFuseAt(prog->program + i, prog->program + prog->size);
+        if(fused.op == fused.base) continue;
+
+        prog->program[i] = fused;
+        result++;
+
+        // locked section runs its instructions as they are
+        if(fused.op == VM_OP_LOCKED) i += fused.imm - 1;
+    }
+    return result;
+}
+
+// streaming loader: bytecode is taken by byte length in chunks of any size, arrays grow
+// geometrically and instructions are parsed (and verified) as soon as they are complete
+#define VM_LOAD_CHUNK 65536 // bytes read at once by vmLoadProgramFd
+
+typedef enum _VM_LOAD_STATUS{
+    VM_LOAD_OK = 0,
+    VM_LOAD_TRUNCATED, // bytecode ends inside an instruction
+    VM_LOAD_UNKNOWN, // no instruction with this icode
+    VM_LOAD_INVALID, // rejected by the verifier
+    VM_LOAD_TARGET, // go to a byte address which is not the start of an instruction
+    VM_LOAD_NO_MEMORY,
+    VM_LOAD_IO,
+    VM_LOAD_COLLISION // ext has an icode twice or one of the base instruction set
+} VM_LOAD_STATUS;
+
+// loader flags
+#define VM_LOAD_VERIFY 1 // checks of vmVerifyProgram, instructions are switched to unchecked handlers
+#define VM_LOAD_BYTE_TARGETS 2 // go num targets are byte offsets in bytecode, converted to indices
+#define VM_LOAD_FUSE 4 // vmFuseProgram on the whole verified program
+
+typedef struct VMLoadError{
+    VM_LOAD_STATUS status;
+    vm_size_t offset; // of the wrong instruction in bytecode
+    vm_size_t index; // of the wrong instruction in program
+} VMLoadError;
+
+typedef struct VMLoader{
+    VMProgram prog; // program holds instructions before the first error
+    vm_size_t capacity, code_capacity;
+    vm_size_t parsed; // bytes of code taken by whole instructions
+    int flags;
+
+    VMInstructionRegistry reg;
+    VMLoadError error;
+} VMLoader;
+
+vm_bool _vmLoaderFail(VMLoader* loader, VM_LOAD_STATUS status, vm_size_t offset){
+    loader->error.status = status;
+    loader->error.offset = offset;
+    loader->error.index = loader->prog.size;
+    return false;
+}
+
+VMLoader vmLoader(const VMInstructionDescriptorsExt* ext, int flags){
+    VMLoader result = {.prog = {.size = 0}, .flags = flags, .error = {.status = VM_LOAD_OK}};
+    result.reg = vmInstructionRegistry(ext);
+    if(result.reg.collision) _vmLoaderFail(&result, VM_LOAD_COLLISION, 0);
+
+    return result;
+}
+
+// capacity for at least need items, doubled
+vm_bool _vmLoaderGrow(void** items, vm_size_t* capacity, vm_size_t need, vm_size_t item_size){
+    if(need <= *capacity) return true;
+
+    vm_size_t grown = *capacity < 64 ? 64 : *capacity;
+    while(grown < need) grown *= 2;
+
+    void* result = realloc(*items, grown * item_size);
+    if(result == NULL) return false;
+
+    *items = result;
+    *capacity = grown;
+    return true;
+}
+
+// bytecode bytes of instruction, 0 for wrong type
+vm_size_t _vmInstructionBytes(const VMInstructionDescriptor* desc){
+    switch (desc->itype){
+    case FREE: return sizeof(vm_uint32_t);
+    case SINGLE: return sizeof(vm_uint32_t) + desc->op0_size;
+    case DOUBLE: return sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size;
+    case TRIPLE: return sizeof(vm_uint32_t) + desc->op0_size + desc->op1_size + desc->op2_size;
+    default: return 0;
+    }
+}
+
+// appends chunk and parses every instruction completed by it, false after the first error
+vm_bool vmLoaderFeed(VMLoader* loader, const vm_uint8_t* chunk, vm_size_t bytes){
+    VMProgram* prog = &loader->prog;
+    if(loader->error.status != VM_LOAD_OK) return false;
+
+    void* code = (void*)prog->code;
+    if(!_vmLoaderGrow(&code, &loader->code_capacity, prog->code_size + bytes, 1)) return _vmLoaderFail(loader, VM_LOAD_NO_MEMORY, prog->code_size);
+
+    prog->code = code;
+    if(bytes > 0) memcpy((vm_uint8_t*)code + prog->code_size, chunk, bytes);
+    prog->code_size += bytes;
+
+    while(prog->code_size - loader->parsed >= sizeof(vm_uint32_t)){
+        const vm_uint8_t* at = prog->code + loader->parsed;
+        const VMInstructionDescriptor* desc = vmRegistryFind(&loader->reg, (const vm_uint32_t*)at);
+
+        vm_size_t size = desc != NULL ? _vmInstructionBytes(desc) : 0;
+        if(size == 0) return _vmLoaderFail(loader, VM_LOAD_UNKNOWN, loader->parsed);
+        if(prog->code_size - loader->parsed < size) break; // rest comes with next chunk
+
+        void* program = prog->program;
+        if(!_vmLoaderGrow(&program, &loader->capacity, prog->size + 1, sizeof(VMInstruction))) return _vmLoaderFail(loader, VM_LOAD_NO_MEMORY, loader->parsed);
+        prog->program = program;
+
+        VMInstruction instr = _vmParseInstruction(prog->code, at, desc).instr;
+        if(instr.op == VM_OP_EXT){
+            instr.desc = _vmProgramDesc(prog, desc);
+            if(instr.desc == VM_DESC_NONE) return _vmLoaderFail(loader, VM_LOAD_NO_MEMORY, loader->parsed);
+        }
+
+        // go targets are checked when the size of the program is known
+        if((loader->flags & VM_LOAD_VERIFY) && instr.op != VM_OP_GO_ADR){
+            VM_OPCODE op = _vmVerifyInstruction(prog, &instr);
+
+            if(op == VM_OPCODES_COUNT) return _vmLoaderFail(loader, VM_LOAD_INVALID, loader->parsed);
+            if(op != VM_OP_EXT) _vmDecodeInstruction(prog, &instr, op);
+        }
+
+        prog->program[prog->size++] = instr;
+        loader->parsed += size;
+    }
+    return true;
+}
+
+// index of instruction starting at byte offset of bytecode, false if there is none
+vm_bool vmProgramIndex(const VMProgram* prog, vm_size_t offset, vm_size_t* index){
+    vm_size_t low = 0, high = prog->size;
+
+    while(low < high){
+        vm_size_t mid = low + (high - low) / 2;
+
+        if(prog->program[mid].icode < offset) low = mid + 1;
+        else high = mid;
+    }
+
+    if(low == prog->size || prog->program[low].icode != offset) return false;
+
+    *index = low;
+    return true;
+}
+
+vm_bool _vmLoaderTargets(VMLoader* loader){
+    VMProgram* prog = &loader->prog;
+
+    for(vm_size_t i = 0; i < prog->size; i++){
+        VMInstruction* instr = prog->program + i;
+        if(instr->op != VM_OP_GO_ADR) continue;
+
+        vm_uint32_t* target = (vm_uint32_t*)VM_OPERAND(prog->code, instr, 0);
+        vm_size_t index = vm_ui32_to_size_t(*target);
+
+        if((loader->flags & VM_LOAD_BYTE_TARGETS) && !vmProgramIndex(prog, index, &index)) index = prog->size;
+
+        if(((loader->flags & VM_LOAD_BYTE_TARGETS) || (loader->flags & VM_LOAD_VERIFY)) && index >= prog->size){
+            loader->error = (VMLoadError){.status = (loader->flags & VM_LOAD_BYTE_TARGETS) ? VM_LOAD_TARGET : VM_LOAD_INVALID, .offset = instr->icode, .index = i};
+            return false;
+        }
+
+        if(loader->flags & VM_LOAD_BYTE_TARGETS) *target = vm_size_t_to_ui32(index);
+        if(loader->flags & VM_LOAD_VERIFY) _vmDecodeInstruction(prog, instr, VM_OP_GO_PC);
+    }
+    return true;
+}
+
+// program of all instructions fed so far, error tells why the program is shorter than bytecode
+VMProgram vmLoaderFinish(VMLoader* loader, VMLoadError* error){
+    VMProgram result = loader->prog;
+
+    if(loader->error.status == VM_LOAD_OK && loader->parsed != result.code_size) _vmLoaderFail(loader, VM_LOAD_TRUNCATED, loader->parsed);
+    if(loader->error.status == VM_LOAD_OK) _vmLoaderTargets(loader);
+
+    // trailing bytes and spare capacity are dropped
+    result.code_size = loader->parsed;
+
+    if(result.code_size == 0){
+        free((void*)result.code);
+        result.code = NULL;
+    }else{
+        void* code = realloc((void*)result.code, result.code_size);
+        if(code != NULL) result.code = code;
+    }
+
+    if(result.size == 0){
+        free(result.program);
+        result.program = NULL;
+    }else{
+        void* program = realloc(result.program, result.size * sizeof(VMInstruction));
+        if(program != NULL) result.program = program;
+    }
+
+    if(loader->error.status == VM_LOAD_OK && (loader->flags & VM_LOAD_VERIFY) && (loader->flags & VM_LOAD_FUSE)) vmFuseProgram(&result);
+
+    if(error != NULL) *error = loader->error;
+
+    vmReleaseInstructionRegistry(&loader->reg);
+    loader->prog = (VMProgram){.size = 0};
+    return result;
+}
+
+VMProgram vmLoadProgram(const vm_uint8_t* bytecode, vm_size_t bytes, const VMInstructionDescriptorsExt* ext, int flags, VMLoadError* error){
+    VMLoader loader = vmLoader(ext, flags);
+    vmLoaderFeed(&loader, bytecode, bytes);
+
+    return vmLoaderFinish(&loader, error);
+}
+
+// reads fd to its end, instructions are parsed while the rest is being read
+VMProgram vmLoadProgramFd(int fd, const VMInstructionDescriptorsExt* ext, int flags, VMLoadError* error){
+    VMLoader loader = vmLoader(ext, flags);
+    vm_uint8_t* chunk = malloc(VM_LOAD_CHUNK);
+
+    if(chunk == NULL) _vmLoaderFail(&loader, VM_LOAD_NO_MEMORY, 0);
+
+    while(chunk != NULL){
+        ssize_t n = read(fd, chunk, VM_LOAD_CHUNK);
+
+        if(n < 0) _vmLoaderFail(&loader, VM_LOAD_IO, loader.prog.code_size);
+        if(n <= 0 || !vmLoaderFeed(&loader, chunk, n)) break;
+    }
+
+    free(chunk);
+    return vmLoaderFinish(&loader, error);
+}
+
+// program images: header, icodes of extension instructions, instructions, code and pool,
+// everything is addressed by offsets so vmLoadProgramImage runs the mapping as it is
+#define VM_IMAGE_MAGIC 0x504d564e // "NVMP"
+#define VM_IMAGE_VERSION 2
+
+typedef struct VMImageHeader{
+    uint32_t magic, version;
+    uint32_t instruction_size; // sizeof(VMInstruction)
+    uint32_t desc_count;
+
+    uint64_t size, code_size;
+    uint64_t pool_size;
+    uint64_t desc_offset, program_offset, code_offset, pool_offset;
+    uint64_t image_size;
+} VMImageHeader;
+
+// writes parsed (and usually verified) program, false if the file can't be written
+vm_bool vmSaveProgramImage(const char* path, const VMProgram* prog){
+    VMImageHeader header = {
+        .magic = VM_IMAGE_MAGIC,
+        .version = VM_IMAGE_VERSION,
+        .instruction_size = sizeof(VMInstruction),
+        .desc_count = prog->desc_count,
+        .size = prog->size,
+        .code_size = prog->code_size,
+        .pool_size = prog->pool_size,
+        .desc_offset = sizeof(VMImageHeader)
+    };
+    header.program_offset = _vmArenaBytes(header.desc_offset + prog->desc_count * sizeof(vm_uint32_t));
+    header.code_offset = header.program_offset + prog->size * sizeof(VMInstruction);
+    header.pool_offset = header.code_offset + prog->code_size;
+    header.image_size = header.pool_offset + prog->pool_size;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+
+    vm_bool result = _vmWriteAt(fd, 0, &header, sizeof(header));
+
+    for(vm_size_t i = 0; i < prog->desc_count && result; i++){
+        result = _vmWriteAt(fd, header.desc_offset + i * sizeof(vm_uint32_t), &prog->desc[i]->icode, sizeof(vm_uint32_t));
+    }
+
+    if(result) result = _vmWriteAt(fd, header.program_offset, prog->program, prog->size * sizeof(VMInstruction));
+    if(result) result = _vmWriteAt(fd, header.code_offset, prog->code, prog->code_size);
+    if(result) result = _vmWriteAt(fd, header.pool_offset, prog->pool, prog->pool_size);
+
+    if(close(fd) < 0) result = false;
+    return result;
+}
+
+// count items of size bytes at offset lie inside the image, without overflow
+vm_bool _vmImageRegion(uint64_t offset, uint64_t count, uint64_t size, uint64_t image_size){
+    return offset <= image_size && count <= (image_size - offset) / size;
+}
+
+// maps image copy-on-write without parsing, pages of the image are shared by every process
+// loading it; extension instructions are found again by icode in ext, empty program if the
+// image doesn't match this build or ext or a region of it lies outside the file
+VMProgram vmLoadProgramImage(const char* path, const VMInstructionDescriptorsExt* ext){
+    VMProgram result = {.size = 0};
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return result; // do some exception here
+
+    VMImageHeader header;
+    vm_bool ok = _vmReadAt(fd, 0, &header, sizeof(header))
+        && header.magic == VM_IMAGE_MAGIC
+        && header.version == VM_IMAGE_VERSION
+        && header.instruction_size == sizeof(VMInstruction)
+        && header.program_offset % VM_CACHE_LINE == 0
+        && header.image_size > 0 && header.image_size <= (uint64_t)(size_t)-1
+        && _vmImageRegion(header.desc_offset, header.desc_count, sizeof(vm_uint32_t), header.image_size)
+        && _vmImageRegion(header.program_offset, header.size, sizeof(VMInstruction), header.image_size)
+        && _vmImageRegion(header.code_offset, header.code_size, 1, header.image_size)
+        && _vmImageRegion(header.pool_offset, header.pool_size, 1, header.image_size);
+
+    off_t file_size = ok ? lseek(fd, 0, SEEK_END) : -1;
+    ok = ok && file_size >= 0 && (uint64_t)file_size >= header.image_size;
+
+    void* image = ok ? mmap(NULL, header.image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if(image == MAP_FAILED) return result; // do some exception here
+
+    // one lookup per extension instruction kind, not per instruction
+    const VMInstructionDescriptor** desc = malloc(header.desc_count * sizeof(*desc));
+
+    for(vm_size_t i = 0; i < header.desc_count && desc != NULL; i++){
+        desc[i] = vmFindInstruction((const vm_uint32_t*)((vm_uint8_t*)image + header.desc_offset) + i, ext);
+
+        if(desc[i] == NULL){
+            free(desc);
+            desc = NULL;
+        }
+    }
+
+    // pool is copied with the capacity _vmPoolTake expects, verifying the program again can grow it
+    vm_uint8_t* pool = header.pool_size > 0 ? malloc(_vmPoolCapacity(header.pool_size)) : NULL;
+    if(pool != NULL) memcpy(pool, (vm_uint8_t*)image + header.pool_offset, header.pool_size);
+
+    if((desc == NULL && header.desc_count > 0) || (pool == NULL && header.pool_size > 0)){
+        // do some exception here
+        free(desc);
+        free(pool);
+        munmap(image, header.image_size);
+        return result;
+    }
+
+    result.program = (VMInstruction*)((vm_uint8_t*)image + header.program_offset);
+    result.size = header.size;
+    result.code = (vm_uint8_t*)image + header.code_offset;
+    result.code_size = header.code_size;
+    result.desc = desc;
+    result.desc_count = header.desc_count;
+    result.pool = pool;
+    result.pool_size = header.pool_size;
+    result.image = image;
+    result.image_size = header.image_size;
+
     return result;
 }
\ No newline at end of file
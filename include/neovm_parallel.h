@@ -0,0 +1,358 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "neovm.h"
+
+
+/////////////////////////////////////////////////////
+//               PARALLEL EXECUTION
+/////////////////////////////////////////////////////
+
+// Runs VM threads on a pool of OS threads instead of TDM (link with -pthread).
+//
+// Memory model:
+// - registers, stacks and stacks ending pointers are shared by all VM threads
+//   (with VM_THREAD_REGISTERS only registers reached by lds / sts are shared)
+//   and accessed without synchronization, so two threads touching the same
+//   register or the same stack at the same time is a race (values may tear)
+// - `lock` waits until every other VM thread has left the instruction it runs
+//   and keeps them stopped until `unlock`, everything written before `unlock`
+//   is visible to every thread after it
+// - use lock / unlock around any state that more than one thread writes,
+//   including push / pop on a shared stack
+//
+// Each worker takes a VM thread, runs it for VM_PARALLEL_QUANTUM instructions
+// and puts it back to its own queue, idle workers steal from the others.
+
+#ifndef VM_PARALLEL_QUANTUM
+#define VM_PARALLEL_QUANTUM 1024
+#endif
+
+#define VM_WORLD_FREE ((vm_size_t)-1)
+
+
+// world lock: slices are readers, thread executing `lock` is the writer
+typedef struct VMWorld{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    vm_size_t owner; // VM thread between lock and unlock
+    vm_size_t running; // slices in flight, except the owner
+} VMWorld;
+
+typedef struct VMWorkQueue{
+    pthread_mutex_t mutex;
+    vm_size_t* item; // exec indices
+    vm_size_t head, count, capacity;
+} VMWorkQueue;
+
+typedef struct VMParallel{
+    const VMExec* exec;
+    vm_size_t exec_count;
+    VMInstance* vm;
+    const VMInstructionDescriptorsExt* ext;
+
+    VMWorld world;
+    VMSync sync;
+
+    VMWorkQueue* queue;
+    vm_size_t workers;
+
+    pthread_mutex_t mutex; // guards remaining
+    pthread_cond_t work;
+    vm_size_t remaining; // VM threads not finished
+} VMParallel;
+
+typedef struct VMWorker{
+    VMParallel* par;
+    vm_size_t id;
+} VMWorker;
+
+
+// world
+void _vmWorldLock(VMInstance* vm, vm_size_t thread){
+    VMWorld* world = &((VMParallel*)vm->sync->data)->world;
+
+    pthread_mutex_lock(&world->mutex);
+
+    if(world->owner != thread){
+        world->running--; // current slice stops being a reader
+        pthread_cond_broadcast(&world->cond); // owner may wait for running == 0
+
+        while(world->owner != VM_WORLD_FREE) pthread_cond_wait(&world->cond, &world->mutex);
+
+        world->owner = thread; // no new slices from here
+
+        // running slices stop at their next instruction
+        for(vm_size_t i = 0; i < vm->threads_count; i++) __atomic_store_n(&vm->thread[i].lock, i != thread, __ATOMIC_RELAXED);
+
+        while(world->running > 0) pthread_cond_wait(&world->cond, &world->mutex);
+    }
+
+    pthread_mutex_unlock(&world->mutex);
+}
+void _vmWorldUnlock(VMInstance* vm, vm_size_t thread){
+    VMWorld* world = &((VMParallel*)vm->sync->data)->world;
+
+    pthread_mutex_lock(&world->mutex);
+
+    if(world->owner == thread){
+        world->owner = VM_WORLD_FREE;
+        world->running++;
+        pthread_cond_broadcast(&world->cond);
+    }
+
+    pthread_mutex_unlock(&world->mutex);
+}
+
+vm_bool _vmWorldEnter(VMWorld* world, vm_size_t thread, const VMInstance* vm){
+    pthread_mutex_lock(&world->mutex);
+
+    while(world->owner != VM_WORLD_FREE && world->owner != thread && !vm->halt && !vm->suspend) pthread_cond_wait(&world->cond, &world->mutex);
+
+    vm_bool enter = !vm->halt && !vm->suspend;
+    if(enter && world->owner != thread) world->running++;
+
+    pthread_mutex_unlock(&world->mutex);
+    return enter;
+}
+void _vmWorldLeave(VMWorld* world, vm_size_t thread, vm_bool release){
+    pthread_mutex_lock(&world->mutex);
+
+    if(world->owner != thread) world->running--;
+    else if(release) world->owner = VM_WORLD_FREE; // finished, halted or suspended without unlock
+
+    pthread_cond_broadcast(&world->cond);
+    pthread_mutex_unlock(&world->mutex);
+}
+
+
+// queues
+void _vmWorkPush(VMWorkQueue* queue, vm_size_t item){
+    pthread_mutex_lock(&queue->mutex);
+    queue->item[(queue->head + queue->count++) % queue->capacity] = item;
+    pthread_mutex_unlock(&queue->mutex);
+}
+vm_bool _vmWorkPop(VMWorkQueue* queue, vm_size_t* item){
+    vm_bool result = false;
+
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->count > 0){
+        *item = queue->item[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        result = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return result;
+}
+vm_bool _vmWorkSteal(VMWorkQueue* queue, vm_size_t* item){
+    vm_bool result = false;
+
+    // take the most recently queued thread, the owner takes the oldest one
+    if(pthread_mutex_trylock(&queue->mutex) != 0) return false;
+    if(queue->count > 0){
+        *item = queue->item[(queue->head + --queue->count) % queue->capacity];
+        result = true;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return result;
+}
+
+vm_bool _vmWorkTake(VMParallel* par, vm_size_t id, vm_size_t* item){
+    if(_vmWorkPop(par->queue + id, item)) return true;
+
+    for(vm_size_t i = 1; i < par->workers; i++){
+        if(_vmWorkSteal(par->queue + (id + i) % par->workers, item)) return true;
+    }
+    return false;
+}
+
+
+vm_bool _vmParallelRunnable(const VMParallel* par, vm_size_t except){
+    for(vm_size_t i = 0; i < par->exec_count; i++){
+        const VMThread* thread = &par->vm->thread[par->exec[i].thread];
+        if(i == except || __atomic_load_n(&thread->lock, __ATOMIC_ACQUIRE)) continue;
+        if(__atomic_load_n(&thread->pc, __ATOMIC_RELAXED) < par->exec[i].prog->size) return true;
+    }
+    return false;
+}
+
+void _vmParallelFinish(VMParallel* par){
+    pthread_mutex_lock(&par->mutex);
+    par->remaining--;
+    pthread_cond_broadcast(&par->work);
+    pthread_mutex_unlock(&par->mutex);
+}
+
+void* _vmParallelWorker(void* arg){
+    VMParallel* par = ((VMWorker*)arg)->par;
+    vm_size_t id = ((VMWorker*)arg)->id;
+    VMInstance* vm = par->vm;
+
+    while(true){
+        vm_size_t i;
+
+        if(!_vmWorkTake(par, id, &i)){
+            pthread_mutex_lock(&par->mutex);
+            if(par->remaining == 0 || vm->halt || vm->suspend){
+                pthread_mutex_unlock(&par->mutex);
+                break;
+            }
+            pthread_cond_wait(&par->work, &par->mutex);
+            pthread_mutex_unlock(&par->mutex);
+            continue;
+        }
+
+        const VMExec* exec = par->exec + i;
+        VMThread* thread = &vm->thread[exec->thread];
+
+        if(!_vmWorldEnter(&par->world, exec->thread, vm)){
+            _vmParallelFinish(par);
+            continue;
+        }
+
+        // the owner of the world lock stays on this worker until it unlocks
+        vm_bool finished, stop;
+        do{
+            // nobody left to unlock it, the thread is dropped with its pc as TDM drops it
+            stop = thread->lock && !_vmParallelRunnable(par, i) && __atomic_load_n(&thread->lock, __ATOMIC_ACQUIRE);
+            if(stop) break;
+
+            VM_FAULT_GUARD(vm, _vmExecSlice(exec, VM_PARALLEL_QUANTUM, vm, par->ext));
+            finished = vm->halt || thread->pc >= exec->prog->size;
+            stop = finished || vm->suspend; // suspended thread keeps its pc
+
+            if((thread->wait || thread->lock) && !stop) sched_yield();
+        }while(!stop && __atomic_load_n(&par->world.owner, __ATOMIC_RELAXED) == exec->thread);
+
+        _vmWorldLeave(&par->world, exec->thread, stop);
+
+        if(stop){
+            if(vm->halt || vm->suspend){
+                pthread_mutex_lock(&par->mutex);
+                pthread_cond_broadcast(&par->work);
+                pthread_mutex_unlock(&par->mutex);
+            }
+            _vmParallelFinish(par);
+        }else{
+            _vmWorkPush(par->queue + id, i);
+
+            pthread_mutex_lock(&par->mutex);
+            pthread_cond_signal(&par->work);
+            pthread_mutex_unlock(&par->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+
+// thread that was between lock and unlock: the only unlocked one while every other is locked
+vm_size_t _vmWorldOwner(const VMExec* exec, vm_size_t exec_count, const VMInstance* vm){
+    vm_size_t owner = VM_WORLD_FREE;
+
+    for(vm_size_t t = 0; t < vm->threads_count; t++){
+        if(vm->thread[t].lock) continue;
+        if(owner != VM_WORLD_FREE) return VM_WORLD_FREE;
+        owner = t;
+    }
+
+    for(vm_size_t i = 0; i < exec_count; i++){
+        if(exec[i].thread == owner && vm->threads_count > 1) return owner;
+    }
+    return VM_WORLD_FREE;
+}
+
+void _vmExecParallel(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext, vm_size_t workers, vm_size_t owner){
+    if(workers == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (vm_size_t)cpus : 1;
+    }
+    if(workers > exec_count) workers = exec_count;
+
+    VMParallel par = {
+        .exec = exec,
+        .exec_count = exec_count,
+        .vm = vm,
+        .ext = ext,
+        .workers = workers,
+        .remaining = exec_count
+    };
+
+    pthread_mutex_init(&par.world.mutex, NULL);
+    pthread_cond_init(&par.world.cond, NULL);
+    par.world.owner = owner;
+    par.world.running = 0;
+
+    pthread_mutex_init(&par.mutex, NULL);
+    pthread_cond_init(&par.work, NULL);
+
+    par.sync = (VMSync){
+        .lock = _vmWorldLock,
+        .unlock = _vmWorldUnlock,
+        .data = &par
+    };
+
+    // setup queues
+    par.queue = malloc(workers * sizeof(VMWorkQueue));
+    for(vm_size_t i = 0; i < workers; i++){
+        pthread_mutex_init(&par.queue[i].mutex, NULL);
+        par.queue[i].item = malloc(exec_count * sizeof(vm_size_t));
+        par.queue[i].head = 0;
+        par.queue[i].count = 0;
+        par.queue[i].capacity = exec_count;
+    }
+    for(vm_size_t i = 0; i < exec_count; i++) _vmWorkPush(par.queue + i % workers, i);
+
+    // execute program
+    const VMSync* sync = vm->sync;
+    vm->sync = &par.sync;
+
+    pthread_t* pool = malloc(workers * sizeof(pthread_t));
+    VMWorker* worker = malloc(workers * sizeof(VMWorker));
+
+    for(vm_size_t i = 0; i < workers; i++){
+        worker[i] = (VMWorker){.par = &par, .id = i};
+        if(i > 0) pthread_create(pool + i, NULL, _vmParallelWorker, worker + i);
+    }
+    _vmParallelWorker(worker); // caller is worker 0
+
+    for(vm_size_t i = 1; i < workers; i++) pthread_join(pool[i], NULL);
+
+    vm->sync = sync;
+
+    // release
+    for(vm_size_t i = 0; i < workers; i++){
+        pthread_mutex_destroy(&par.queue[i].mutex);
+        free(par.queue[i].item);
+    }
+    free(par.queue);
+    free(pool);
+    free(worker);
+
+    pthread_cond_destroy(&par.work);
+    pthread_mutex_destroy(&par.mutex);
+    pthread_cond_destroy(&par.world.cond);
+    pthread_mutex_destroy(&par.world.mutex);
+}
+
+// workers = 0 uses one worker per online CPU
+void vmExecProgramParallel(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext, vm_size_t workers){
+    // init threads
+    if(!_vmExecInit(exec, exec_count, vm, true) || exec_count == 0) return;
+
+    _vmExecParallel(exec, exec_count, vm, ext, workers, VM_WORLD_FREE);
+}
+
+// goes on after vmSuspend or vmRestore, a thread suspended between lock and unlock keeps the world lock
+void vmResumeProgramParallel(const VMExec* exec, vm_size_t exec_count, VMInstance* vm, const VMInstructionDescriptorsExt* ext, vm_size_t workers){
+    if(!_vmExecInit(exec, exec_count, vm, false) || exec_count == 0) return;
+
+    _vmExecParallel(exec, exec_count, vm, ext, workers, _vmWorldOwner(exec, exec_count, vm));
+}
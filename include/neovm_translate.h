@@ -0,0 +1,253 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "neovm.h"
+
+
+/////////////////////////////////////////////////////
+//               AHEAD-OF-TIME TRANSLATION
+/////////////////////////////////////////////////////
+
+// Translates a program to C source running it without dispatch. The source holds copies of
+// instructions, bytecode and pool, a slice function and a constructor:
+//
+//   vm_size_t name_slice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext);
+//   VMProgram name_program(const VMInstructionDescriptorsExt* ext);
+//
+// Every instruction is a labelled statement, go num becomes goto, decoded register and stack
+// instructions call their handlers on constant operands (inlined by the compiler), others go
+// through vmExecInstruction. Like the JIT, blocks of up to VM_AOT_BLOCK instructions take
+// their length of quantum at once and the interpreter runs the rest of quantum shorter than a
+// block, so TDM slices end where the interpreter's do.
+//
+// The source is included after neovm.h into a build with the same VM_NATIVE_REGISTERS option.
+
+#ifndef VM_AOT_BLOCK
+#define VM_AOT_BLOCK 32 // instructions in a block at most
+#endif
+
+
+// used by translated code: thread, prog, program, tid and done are locals of name_slice
+
+// quantum is shorter than the block starting at instruction at
+#define _VM_AOT_REST(at) { thread->pc = (at); return done + _vmInterpretSlice(exec, quantum - done, vm, ext); }
+
+#define _VM_AOT_BLOCK(at, count)\
+    if(quantum - done < (count)) _VM_AOT_REST(at)\
+    done += (count);
+
+// entry inside a block takes the rest of it
+#define _VM_AOT_ENTRY(at, count)\
+    _VM_AOT_BLOCK(at, count)\
+    goto pc_##at;
+
+// handler may wait, lock, halt or go anywhere
+#define _VM_AOT_CALL(at)\
+    thread->pc = (at);\
+    vmExecInstruction(prog, program + (at), tid, vm, ext);\
+    if(thread->wait) return done;\
+    if(++thread->pc != (at) + 1 || thread->lock || vm->halt || vm->suspend) goto dispatch;
+
+// suspend is noticed at go and at calls
+#define _VM_AOT_GO(next)\
+    if(vm->suspend){ thread->pc = (next); return done; }
+
+// pc of an instruction hitting a guard page is kept as the interpreter does
+#ifdef VM_GUARDED_STACKS
+#define _VM_AOT_STACK(at) thread->pc = (at);
+#else
+#define _VM_AOT_STACK(at)
+#endif
+
+// program of translated code: instructions, bytecode and pool are copied the way vmParseProgram
+// keeps them, extension instructions are found again by icode in ext, empty program if one of
+// them is missing or out of memory
+VMProgram _vmTranslatedProgram(const VMInstruction* program, vm_size_t size, const vm_uint8_t* code, vm_size_t code_size,
+                               const vm_uint32_t* icodes, vm_size_t desc_count, const vm_uint8_t* pool, vm_size_t pool_size,
+                               vm_size_t (*slice)(const VMExec*, vm_size_t, VMInstance*, const VMInstructionDescriptorsExt*),
+                               const VMInstructionDescriptorsExt* ext){
+    VMProgram result = {.size = 0};
+    VMInstruction* instructions = malloc(size * sizeof(VMInstruction));
+    vm_uint8_t* code_copy = malloc(code_size > 0 ? code_size : 1);
+    const VMInstructionDescriptor** desc = desc_count > 0 ? malloc(desc_count * sizeof(*desc)) : NULL;
+    vm_uint8_t* pool_copy = pool_size > 0 ? malloc(_vmPoolCapacity(pool_size)) : NULL; // as _vmPoolTake expects
+
+    vm_bool ok = instructions != NULL && code_copy != NULL && (desc != NULL || desc_count == 0) && (pool_copy != NULL || pool_size == 0);
+
+    for(vm_size_t i = 0; i < desc_count && ok; i++){
+        desc[i] = vmFindInstruction(icodes + i, ext);
+        ok = desc[i] != NULL;
+    }
+
+    if(!ok){
+        // do some exception here
+        free(instructions);
+        free(code_copy);
+        free(desc);
+        free(pool_copy);
+        return result;
+    }
+
+    memcpy(instructions, program, size * sizeof(VMInstruction));
+    memcpy(code_copy, code, code_size);
+    if(pool_size > 0) memcpy(pool_copy, pool, pool_size);
+
+    result.program = instructions;
+    result.size = size;
+    result.code = code_copy;
+    result.code_size = code_size;
+    result.desc = desc;
+    result.desc_count = desc_count;
+    result.pool = pool_copy;
+    result.pool_size = pool_size;
+    result.slice = slice;
+
+    return result;
+}
+
+
+// name of the handler run inline for op, NULL if it is called through vmExecInstruction
+const char* _vmTranslateHandler(VM_OPCODE op, char* name, vm_size_t size){
+    static const char* const kinds[6] = {"snd_r%d_r%d", "snd_num%d_r%d", "push%d_r%d", "pop%d_r%d", "inc_r%d_r%d", "dec_r%d_r%d"};
+    int bits;
+
+    if(op >= VM_OP_SND_R8_R8 && op <= VM_OP_DEC_R256_R256){
+        // six bitdepths of every kind
+        vm_size_t kind = (op - VM_OP_SND_R8_R8) / 6, depth = (op - VM_OP_SND_R8_R8) % 6;
+        bits = 8 << depth;
+        snprintf(name, size, "_vm_");
+        snprintf(name + 4, size - 4, kinds[kind], bits, bits);
+        return name;
+    }
+    if(op >= VM_OP_PUSH8_IMM && op <= VM_OP_PUSH256_IMM){
+        snprintf(name, size, "_vm_push%d_imm", 8 << (op - VM_OP_PUSH8_IMM));
+        return name;
+    }
+    return NULL;
+}
+
+void _vmTranslateBytes(FILE* out, const vm_uint8_t* bytes, vm_size_t size){
+    if(size == 0) fprintf(out, "    0");
+
+    for(vm_size_t i = 0; i < size; i++){
+        fprintf(out, "%s0x%02x%s", i % 12 == 0 ? "    " : "", bytes[i], i + 1 == size ? "" : (i % 12 == 11 ? ",\n" : ", "));
+    }
+    fprintf(out, "\n");
+}
+
+// writes C source running prog as name_slice and name_program, name must be a C identifier;
+// verified programs run inline, false if out can't be written or out of memory
+vm_bool vmTranslateProgram(const VMProgram* prog, const char* name, FILE* out){
+    vm_size_t* rem = _vmNativeBlocks(prog, VM_AOT_BLOCK);
+    if(rem == NULL) return false;
+
+    vm_bool calls = false;
+    for(vm_size_t i = 0; i < prog->size; i++) calls = calls || !_vmNativeInline(prog->program + i);
+
+    fprintf(out, "// %s: %zu instructions translated by vmTranslateProgram, include after neovm.h\n", name, (size_t)prog->size);
+    fprintf(out, "#include \"neovm_translate.h\"\n\n");
+#ifdef VM_REGISTERS_LE
+    fprintf(out, "#ifndef VM_REGISTERS_LE\n#error \"%s is translated with VM_NATIVE_REGISTERS on a little-endian host\"\n#endif\n\n", name);
+#else
+    fprintf(out, "#ifdef VM_REGISTERS_LE\n#error \"%s is translated without VM_NATIVE_REGISTERS\"\n#endif\n\n", name);
+#endif
+
+    // data of name_program
+    fprintf(out, "static const vm_uint8_t %s_code[%zu] = {\n", name, (size_t)(prog->code_size > 0 ? prog->code_size : 1));
+    _vmTranslateBytes(out, prog->code, prog->code_size);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const vm_uint8_t %s_pool[%zu] = {\n", name, (size_t)(prog->pool_size > 0 ? prog->pool_size : 1));
+    _vmTranslateBytes(out, prog->pool, prog->pool_size);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const vm_uint32_t %s_icodes[%zu] = {", name, (size_t)(prog->desc_count > 0 ? prog->desc_count : 1));
+    if(prog->desc_count == 0) fprintf(out, "{{0}}");
+    for(vm_size_t i = 0; i < prog->desc_count; i++){
+        const vm_uint8_t* icode = prog->desc[i]->icode.bytes;
+        fprintf(out, "%s{{0x%02x, 0x%02x, 0x%02x, 0x%02x}}", i > 0 ? ", " : "", icode[0], icode[1], icode[2], icode[3]);
+    }
+    fprintf(out, "};\n\n");
+
+    // superinstructions are replaced by their first instruction, the compiler joins them anyway
+    fprintf(out, "// icode, op, op1, op2, r0, r1, base, desc / imm / pool\n");
+    fprintf(out, "static const VMInstruction %s_instructions[%zu] = {\n", name, (size_t)(prog->size > 0 ? prog->size : 1));
+    if(prog->size == 0) fprintf(out, "    {0}\n");
+    for(vm_size_t i = 0; i < prog->size; i++){
+        const VMInstruction* instr = prog->program + i;
+        VMInstruction native = *instr;
+        native.op = _vmNativeOp(instr);
+
+        const VMInstructionDescriptor* desc = _vmInstructionDesc(prog, &native, NULL);
+        fprintf(out, "    {0x%08x, %u, %u, %u, %u, %u, %u, {%u}}, // %zu: %s\n", (unsigned)native.icode, (unsigned)native.op,
+            (unsigned)native.op1, (unsigned)native.op2, (unsigned)native.r0, (unsigned)native.r1, (unsigned)native.base,
+            (unsigned)native.desc, (size_t)i, desc != NULL && desc->alias != NULL ? desc->alias : "?");
+    }
+    fprintf(out, "};\n\n");
+
+    // name_slice
+    fprintf(out, "vm_size_t %s_slice(const VMExec* exec, vm_size_t quantum, VMInstance* vm, const VMInstructionDescriptorsExt* ext){\n", name);
+    fprintf(out, "    VMThread* thread = &vm->thread[exec->thread];\n");
+    fprintf(out, "    const VMProgram* prog = exec->prog;\n");
+    fprintf(out, "    const VMInstruction* program = %s_instructions;\n", name);
+    fprintf(out, "    vm_size_t tid = exec->thread;\n");
+    fprintf(out, "    vm_size_t done = 0;\n\n");
+
+    fprintf(out, "%s", calls ? "dispatch:\n" : "");
+    fprintf(out, "    if(thread->lock || vm->halt || vm->suspend || thread->pc >= %zu) return done;\n", (size_t)prog->size);
+    fprintf(out, "    switch(thread->pc){\n");
+    for(vm_size_t i = 0, count = 0; i < prog->size; i++){
+        if(count == 0){
+            count = rem[i];
+            fprintf(out, "    case %zu: goto pc_%zu;\n", (size_t)i, (size_t)i);
+        }else fprintf(out, "    case %zu: _VM_AOT_ENTRY(%zu, %zu)\n", (size_t)i, (size_t)i, (size_t)rem[i]);
+        count--;
+    }
+    fprintf(out, "    default: return done;\n    }\n\n");
+
+    for(vm_size_t i = 0, count = 0; i < prog->size; i++){
+        const VMInstruction* instr = prog->program + i;
+        VM_OPCODE op = _vmNativeOp(instr);
+        char handler[32];
+
+        fprintf(out, "pc_%zu:", (size_t)i);
+        if(count == 0){
+            count = rem[i];
+            fprintf(out, " _VM_AOT_BLOCK(%zu, %zu)", (size_t)i, (size_t)count);
+        }
+        fprintf(out, "\n");
+        count--;
+
+        if(op == VM_OP_GO_PC && (vm_size_t)instr->imm + 1 < prog->size){
+            fprintf(out, "    _VM_AOT_GO(%zu) goto pc_%zu;\n", (size_t)instr->imm + 1, (size_t)instr->imm + 1);
+        }else if(op == VM_OP_GO_PC){
+            fprintf(out, "    thread->pc = %zu;\n    return done;\n", (size_t)instr->imm + 1);
+        }else if(_vmTranslateHandler(op, handler, sizeof(handler)) != NULL){
+            vm_bool stack = (op >= VM_OP_PUSH8_R8 && op <= VM_OP_POP256_R256) || (op >= VM_OP_PUSH8_IMM && op <= VM_OP_PUSH256_IMM);
+            fprintf(out, "    ");
+            if(stack) fprintf(out, "_VM_AOT_STACK(%zu) ", (size_t)i);
+            fprintf(out, "%s(prog, program + %zu, tid, vm);\n", handler, (size_t)i);
+        }else fprintf(out, "    _VM_AOT_CALL(%zu)\n", (size_t)i);
+    }
+    fprintf(out, "\n    thread->pc = %zu;\n    return done;\n}\n\n", (size_t)prog->size);
+
+    // name_program
+    fprintf(out, "// program running %s_slice, empty if ext lacks one of its extension instructions\n", name);
+    fprintf(out, "VMProgram %s_program(const VMInstructionDescriptorsExt* ext){\n", name);
+    fprintf(out, "    return _vmTranslatedProgram(%s_instructions, %zu, %s_code, %zu, %s_icodes, %zu, %s_pool, %zu, %s_slice, ext);\n}\n",
+        name, (size_t)prog->size, name, (size_t)prog->code_size, name, (size_t)prog->desc_count, name, (size_t)prog->pool_size, name);
+
+    free(rem);
+    return ferror(out) == 0;
+}
+
+// loads bytecode of bytes length with VM_LOAD_VERIFY and translates it, false if bytecode
+// doesn't load (error tells why) or out can't be written
+vm_bool vmTranslateBytecode(const vm_uint8_t* bytecode, vm_size_t bytes, const VMInstructionDescriptorsExt* ext, const char* name, FILE* out, VMLoadError* error){
+    VMProgram prog = vmLoadProgram(bytecode, bytes, ext, VM_LOAD_VERIFY, error);
+    vm_bool result = error->status == VM_LOAD_OK && vmTranslateProgram(&prog, name, out);
+
+    vmReleaseProgram(&prog);
+    return result;
+}
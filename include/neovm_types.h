@@ -105,23 +105,33 @@ _vm_decl_i(256)
 #define VM_INT256_T(some256) VM_INT256_T_PTR(some256)[0]
 
 
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#define VM_HOST_BIG_ENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#endif
+
 vm_bool vm_host_is_big_endian(){
+#ifdef VM_HOST_BIG_ENDIAN
+    return VM_HOST_BIG_ENDIAN ? true : false;
+#else
     unsigned short magic = 0xffaa;
     return VM_INT8_T(magic) == 0xff;
+#endif
 }
 
+// only the lowest sizeof(vm_size_t) bytes are taken, higher bytes are dropped
 #define _vm_ui_to_size_t(bitdepth)\
 vm_size_t _cat(vm_ui, _cat(bitdepth, _to_size_t))(_vm_ui(bitdepth) a){\
-    vm_size_t result;\
-    if(vm_host_is_big_endian()){\
-        vm_size_t size = sizeof(result);\
-        for(vm_size_t i = 0; i < size; i++)\
-            VM_UINT8_T_PTR(result)[size - i - 1] = i < _vm_ui_size(bitdepth) ? a.bytes[_vm_ui_size(bitdepth) - i - 1] : 0x00;\
-    }else{\
-        vm_size_t size = sizeof(result);\
-        for(vm_size_t i = 0; i < size; i++)\
-            VM_UINT8_T_PTR(result)[i] = i < _vm_ui_size(bitdepth) ? a.bytes[_vm_ui_size(bitdepth) - i - 1] : 0x00;\
-    }\
+    vm_size_t result = 0;\
+    vm_size_t size = sizeof(result) < _vm_ui_size(bitdepth) ? sizeof(result) : _vm_ui_size(bitdepth);\
+    for(vm_size_t i = 0; i < size; i++)\
+        result |= (vm_size_t)a.bytes[_vm_ui_size(bitdepth) - i - 1] << (8 * i);\
+    return result;\
+}
+#define _vm_size_t_to_ui(bitdepth)\
+_vm_ui(bitdepth) _cat(vm_size_t_to_ui, bitdepth)(vm_size_t a){\
+    _vm_ui(bitdepth) result;\
+    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++)\
+        result.bytes[_vm_ui_size(bitdepth) - i - 1] = i < sizeof(a) ? (vm_uint8_t)(a >> (8 * i)) : 0x00;\
     return result;\
 }
 
@@ -131,23 +141,134 @@ _vm_ui_to_size_t(64)
 _vm_ui_to_size_t(128)
 _vm_ui_to_size_t(256)
 
+_vm_size_t_to_ui(16)
+_vm_size_t_to_ui(32)
+_vm_size_t_to_ui(64)
+_vm_size_t_to_ui(128)
+_vm_size_t_to_ui(256)
+
 
 /////////////////////////////////////////////////////
 //                   OPERATIONS
 /////////////////////////////////////////////////////
 
+// limbs
+typedef unsigned long long vm_limb_t;
+
+#define _vm_limb_size sizeof(vm_limb_t)
+#define _vm_limbs(bitdepth) (_vm_ui_size(bitdepth) >= _vm_limb_size ? _vm_ui_size(bitdepth) / _vm_limb_size : 1)
+#define _vm_limb_bytes(bitdepth) (_vm_ui_size(bitdepth) >= _vm_limb_size ? _vm_limb_size : _vm_ui_size(bitdepth))
+
+#ifdef __has_builtin
+    #if __has_builtin(__builtin_addcll) && __has_builtin(__builtin_subcll)
+    #define VM_HAS_ADDCLL
+    #endif
+#endif
+
+// big-endian bytes <-> limb, full limbs are a single (byte swapped) load / store
+vm_limb_t _vm_load_limb(const vm_uint8_t* bytes, vm_size_t size){
+    vm_limb_t result = 0;
+#if defined(__GNUC__) && defined(VM_HOST_BIG_ENDIAN)
+    if(size == _vm_limb_size){
+        __builtin_memcpy(&result, bytes, _vm_limb_size);
+        return VM_HOST_BIG_ENDIAN ? result : __builtin_bswap64(result);
+    }
+#endif
+    for(vm_size_t i = 0; i < size; i++) result = (result << 8) | bytes[i];
+    return result;
+}
+void _vm_store_limb(vm_uint8_t* bytes, vm_size_t size, vm_limb_t limb){
+#if defined(__GNUC__) && defined(VM_HOST_BIG_ENDIAN)
+    if(size == _vm_limb_size){
+        limb = VM_HOST_BIG_ENDIAN ? limb : __builtin_bswap64(limb);
+        __builtin_memcpy(bytes, &limb, _vm_limb_size);
+        return;
+    }
+#endif
+    for(vm_size_t i = 0; i < size; i++) bytes[size - i - 1] = (vm_uint8_t)(limb >> (8 * i));
+}
+
+// add / sub with carry, partial limbs (size < 8 bytes) keep carry above the value bits
+vm_limb_t _vm_addc_limb(vm_limb_t a, vm_limb_t b, vm_limb_t carry, vm_limb_t* result, vm_size_t size){
+    if(size < _vm_limb_size){
+        vm_limb_t sum = a + b + carry;
+        *result = sum & ((1ull << (8 * size)) - 1);
+        return sum >> (8 * size);
+    }
+#if defined(VM_HAS_ADDCLL)
+    vm_limb_t carry_out;
+    *result = __builtin_addcll(a, b, carry, &carry_out);
+    return carry_out;
+#elif defined(__GNUC__)
+    vm_limb_t of0 = __builtin_add_overflow(a, b, result);
+    vm_limb_t of1 = __builtin_add_overflow(*result, carry, result);
+    return of0 | of1;
+#else
+    vm_limb_t sum = a + b;
+    vm_limb_t of0 = sum < a;
+    *result = sum + carry;
+    return of0 | (*result < sum);
+#endif
+}
+vm_limb_t _vm_subb_limb(vm_limb_t a, vm_limb_t b, vm_limb_t borrow, vm_limb_t* result, vm_size_t size){
+    if(size < _vm_limb_size){
+        vm_limb_t diff = a - b - borrow;
+        *result = diff & ((1ull << (8 * size)) - 1);
+        return (diff >> (8 * size)) & 1;
+    }
+#if defined(VM_HAS_ADDCLL)
+    vm_limb_t borrow_out;
+    *result = __builtin_subcll(a, b, borrow, &borrow_out);
+    return borrow_out;
+#elif defined(__GNUC__)
+    vm_limb_t of0 = __builtin_sub_overflow(a, b, result);
+    vm_limb_t of1 = __builtin_sub_overflow(*result, borrow, result);
+    return of0 | of1;
+#else
+    vm_limb_t diff = a - b;
+    vm_limb_t of0 = a < b;
+    *result = diff - borrow;
+    return of0 | (diff < borrow);
+#endif
+}
+
+// walk limbs from the least significant one (the last in big-endian order)
+#define _vm_limb_kernel(bitdepth, name, limb_op, carry_in)\
+vm_limb_t _cat(name, bitdepth)(_vm_ui(bitdepth)* result, const _vm_ui(bitdepth)* a, const _vm_ui(bitdepth)* b){\
+    vm_limb_t carry = carry_in;\
+    for(vm_size_t i = _vm_limbs(bitdepth); i-- > 0;){\
+        const vm_size_t offset = i * _vm_limb_bytes(bitdepth);\
+        vm_limb_t limb;\
+        carry = limb_op(\
+            _vm_load_limb(a->bytes + offset, _vm_limb_bytes(bitdepth)),\
+            b != NULL ? _vm_load_limb(b->bytes + offset, _vm_limb_bytes(bitdepth)) : 0,\
+            carry, &limb, _vm_limb_bytes(bitdepth)\
+        );\
+        _vm_store_limb(result->bytes + offset, _vm_limb_bytes(bitdepth), limb);\
+    }\
+    return carry;\
+}
+
 // logical
+#define _vm_cmp_ui(bitdepth)\
+int _cat(vm_cmp_ui, bitdepth)(_vm_ui(bitdepth) a, _vm_ui(bitdepth) b){\
+    for(vm_size_t i = 0; i < _vm_limbs(bitdepth); i++){\
+        vm_limb_t x = _vm_load_limb(a.bytes + i * _vm_limb_bytes(bitdepth), _vm_limb_bytes(bitdepth));\
+        vm_limb_t y = _vm_load_limb(b.bytes + i * _vm_limb_bytes(bitdepth), _vm_limb_bytes(bitdepth));\
+        if(x != y) return x < y ? -1 : 1;\
+    }\
+    return 0;\
+}
 #define _vm_equal_ui(bitdepth)\
 vm_bool _cat(vm_equal_ui, bitdepth)(_vm_ui(bitdepth) a, _vm_ui(bitdepth) b){\
-    vm_bool result = true;\
-    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++) result = result && (a.bytes[i] == b.bytes[i]);\
-    return result;\
+    vm_limb_t diff = 0;\
+    for(vm_size_t i = 0; i < _vm_limbs(bitdepth); i++)\
+        diff |= _vm_load_limb(a.bytes + i * _vm_limb_bytes(bitdepth), _vm_limb_bytes(bitdepth)) ^ _vm_load_limb(b.bytes + i * _vm_limb_bytes(bitdepth), _vm_limb_bytes(bitdepth));\
+    return diff == 0 ? true : false;\
 }
 #define _vm_not_equal_ui(bitdepth)\
 vm_bool _cat(vm_not_equal_ui, bitdepth)(_vm_ui(bitdepth) a, _vm_ui(bitdepth) b){\
-    vm_bool result = false;\
-    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++) result = result || (a.bytes[i] != b.bytes[i]);\
-    return result;\
+    return _cat(vm_equal_ui, bitdepth)(a, b) ? false : true;\
 }
 
 // bitwise
@@ -178,47 +299,51 @@ _vm_ui(bitdepth) _cat(vm_inverse_ui, bitdepth)(_vm_ui(bitdepth) a){\
 
 // arithmetic
 #define _vm_inc_ui(bitdepth)\
+_vm_limb_kernel(bitdepth, _vm_inc_limbs_ui, _vm_addc_limb, 1)\
 _vm_ui(bitdepth) _cat(vm_inc_ui, bitdepth)(_vm_ui(bitdepth) a){\
     _vm_ui(bitdepth) result;\
-    vm_uint8_t of = 1;\
-    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++){\
-        if(i > 0 && of != 0) of = a.bytes[_vm_ui_size(bitdepth) - i] == 0xff ? 1 : 0;\
-        result.bytes[_vm_ui_size(bitdepth) - i - 1] = a.bytes[_vm_ui_size(bitdepth) - i - 1] + of;\
-    }\
+    _cat(_vm_inc_limbs_ui, bitdepth)(&result, &a, NULL);\
     return result;\
 }
 #define _vm_dec_ui(bitdepth)\
+_vm_limb_kernel(bitdepth, _vm_dec_limbs_ui, _vm_subb_limb, 1)\
 _vm_ui(bitdepth) _cat(vm_dec_ui, bitdepth)(_vm_ui(bitdepth) a){\
     _vm_ui(bitdepth) result;\
-    vm_uint8_t of = 1;\
-    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++){\
-        if(i > 0 && of != 0) of = a.bytes[_vm_ui_size(bitdepth) - i] == 0 ? 1 : 0;\
-        result.bytes[_vm_ui_size(bitdepth) - i - 1] = a.bytes[_vm_ui_size(bitdepth) - i - 1] - of;\
-    }\
+    _cat(_vm_dec_limbs_ui, bitdepth)(&result, &a, NULL);\
     return result;\
 }
 
-#define _vm_add_ui_of(a, b, c) ((int)(a) >= 256 - (int)(c)) || ((int)(a) >= 256 - (int)(b)) || ((int)(b) >= 256 - (int)(c)) ||((int)(a) >= 256 - (int)(b) - (int)(c) ? 1 : 0)
-
 #define _vm_add_ui(bitdepth)\
+_vm_limb_kernel(bitdepth, _vm_add_limbs_ui, _vm_addc_limb, 0)\
 typedef struct _cat(vm_add_ui, _cat(bitdepth, _result)){\
     _vm_ui(bitdepth) result;\
     vm_uint8_t rem;\
 } _cat(vm_add_ui, _cat(bitdepth, _result));\
 _cat(vm_add_ui, _cat(bitdepth, _result)) _cat(vm_add_ui, bitdepth)(_vm_ui(bitdepth) a, _vm_ui(bitdepth) b){\
+    _cat(vm_add_ui, _cat(bitdepth, _result)) result;\
+    result.rem = (vm_uint8_t)_cat(_vm_add_limbs_ui, bitdepth)(&result.result, &a, &b);\
+    return result;\
+}
+#define _vm_sub_ui(bitdepth)\
+_vm_limb_kernel(bitdepth, _vm_sub_limbs_ui, _vm_subb_limb, 0)\
+typedef struct _cat(vm_sub_ui, _cat(bitdepth, _result)){\
     _vm_ui(bitdepth) result;\
-    vm_uint8_t of_curr = 0;\
-    vm_uint8_t of_prev = 0;\
-    for(vm_size_t i = 0; i < _vm_ui_size(bitdepth); i++){\
-        of_curr = _vm_add_ui_of(a.bytes[_vm_ui_size(bitdepth) - i - 1], b.bytes[_vm_ui_size(bitdepth) - i - 1], of_prev);\
-        result.bytes[_vm_ui_size(bitdepth) - i - 1] = a.bytes[_vm_ui_size(bitdepth) - i - 1] + b.bytes[_vm_ui_size(bitdepth) - i - 1] + of_prev;\
-        of_prev = of_curr;\
-    }\
-    return (_cat(vm_add_ui, _cat(bitdepth, _result))){result, of_curr};\
+    vm_uint8_t rem; /* borrow */\
+} _cat(vm_sub_ui, _cat(bitdepth, _result));\
+_cat(vm_sub_ui, _cat(bitdepth, _result)) _cat(vm_sub_ui, bitdepth)(_vm_ui(bitdepth) a, _vm_ui(bitdepth) b){\
+    _cat(vm_sub_ui, _cat(bitdepth, _result)) result;\
+    result.rem = (vm_uint8_t)_cat(_vm_sub_limbs_ui, bitdepth)(&result.result, &a, &b);\
+    return result;\
 }
 
 
 
+_vm_cmp_ui(16)
+_vm_cmp_ui(32)
+_vm_cmp_ui(64)
+_vm_cmp_ui(128)
+_vm_cmp_ui(256)
+
 _vm_equal_ui(16)
 _vm_equal_ui(32)
 _vm_equal_ui(64)
@@ -271,4 +396,10 @@ _vm_add_ui(16)
 _vm_add_ui(32)
 _vm_add_ui(64)
 _vm_add_ui(128)
-_vm_add_ui(256)
\ No newline at end of file
+_vm_add_ui(256)
+
+_vm_sub_ui(16)
+_vm_sub_ui(32)
+_vm_sub_ui(64)
+_vm_sub_ui(128)
+_vm_sub_ui(256)
\ No newline at end of file
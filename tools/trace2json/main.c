@@ -0,0 +1,166 @@
+#include "stdio.h"
+#include "string.h"
+
+#define VM_TARGET_ARCH64 // for correct vm_size_t
+#define VM_TRACE
+#include "neovm.h"
+
+// Converts a trace written by vmTraceWrite to Chrome trace JSON (chrome://tracing, Perfetto):
+//
+//   trace2json [-i] trace.nvmt [trace.json]
+//
+// Every VM thread is a track with its TDM slices, network waits (from the first turn ending
+// waiting to the turn that didn't) and locked sections. -i adds an instant event for every
+// instruction.
+
+
+typedef struct TraceThread{
+    vm_bool seen;
+    vm_bool in_slice, waited; // turn began, it ended waiting
+    vm_bool waiting, locked;
+    double slice_at, wait_at, lock_at;
+    uint32_t slice_pc;
+    uint64_t executed;
+} TraceThread;
+
+typedef struct TraceOutput{
+    FILE* out;
+    vm_bool first;
+} TraceOutput;
+
+// microseconds since vmTraceStart
+double traceTime(const VMTraceHeader* header, uint64_t stamp){
+    if(!header->tsc) return (double)(stamp - header->ns_start) / 1000.0;
+
+    double ns_per_tick = header->tsc_end > header->tsc_start ? (double)(header->ns_end - header->ns_start) / (double)(header->tsc_end - header->tsc_start) : 0.0;
+    return (double)(stamp - header->tsc_start) * ns_per_tick / 1000.0;
+}
+
+void traceEvent(TraceOutput* out, const char* name, const char* cat, const char* ph, double ts, double dur, uint32_t tid, const char* args){
+    fprintf(out->out, "%s\n    {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, ", out->first ? "" : ",", name, cat, ph, ts);
+    if(ph[0] == 'X') fprintf(out->out, "\"dur\": %.3f, ", dur);
+    if(ph[0] == 'i') fprintf(out->out, "\"s\": \"%s\", ", strcmp(cat, "halt") == 0 ? "g" : "t");
+    fprintf(out->out, "\"pid\": 0, \"tid\": %u, \"args\": {%s}}", (unsigned)tid, args);
+    out->first = false;
+}
+
+int main(int argc, char** argv){
+    vm_bool instructions = argc > 1 && strcmp(argv[1], "-i") == 0;
+    int arg = instructions ? 2 : 1;
+
+    if(arg >= argc){
+        fprintf(stderr, "usage: %s [-i] trace.nvmt [trace.json]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[arg], "rb");
+    VMTraceHeader header;
+
+    if(in == NULL || fread(&header, sizeof(header), 1, in) != 1 || header.magic != VM_TRACE_MAGIC
+       || header.version != VM_TRACE_VERSION || header.record_size != sizeof(VMTraceRecord)){
+        fprintf(stderr, "%s is not a trace of this build\n", argv[arg]);
+        if(in != NULL) fclose(in);
+        return 1;
+    }
+
+    VMTraceRecord* record = malloc((header.count > 0 ? header.count : 1) * sizeof(VMTraceRecord));
+    if(record == NULL || fread(record, sizeof(VMTraceRecord), header.count, in) != header.count){
+        fprintf(stderr, "%s is truncated\n", argv[arg]);
+        free(record);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+
+    uint32_t threads = 0;
+    for(uint64_t i = 0; i < header.count; i++){
+        if(record[i].thread >= threads) threads = record[i].thread + 1;
+    }
+
+    TraceThread* thread = calloc(threads > 0 ? threads : 1, sizeof(TraceThread));
+    TraceOutput out = {.out = arg + 1 < argc ? fopen(argv[arg + 1], "w") : stdout, .first = true};
+
+    if(thread == NULL || out.out == NULL){
+        fprintf(stderr, "can't write %s\n", arg + 1 < argc ? argv[arg + 1] : "output");
+        free(thread);
+        free(record);
+        return 1;
+    }
+
+    fprintf(out.out, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"records\": %llu, \"lost\": %llu}, \"traceEvents\": [",
+        (unsigned long long)header.count, (unsigned long long)header.lost);
+
+    char args[96];
+    for(uint64_t i = 0; i < header.count; i++){
+        const VMTraceRecord* r = record + i;
+        TraceThread* t = thread + r->thread;
+        double ts = traceTime(&header, r->tsc);
+
+        if(!t->seen){
+            snprintf(args, sizeof(args), "\"name\": \"thread %u\"", (unsigned)r->thread);
+            traceEvent(&out, "thread_name", "meta", "M", 0, 0, r->thread, args);
+            t->seen = true;
+        }
+
+        switch(r->event){
+        case VM_TRACE_EXEC:
+            t->executed++;
+            if(instructions){
+                const VMInstructionDescriptor* desc = vmFindInstruction(&r->icode, NULL);
+                snprintf(args, sizeof(args), "\"pc\": %u, \"icode\": \"0x%02x%02x%02x%02x\"", (unsigned)r->pc,
+                    r->icode.bytes[0], r->icode.bytes[1], r->icode.bytes[2], r->icode.bytes[3]);
+                traceEvent(&out, desc != NULL && desc->alias != NULL ? desc->alias : "ext", "instruction", "i", ts, 0, r->thread, args);
+            }
+            break;
+        case VM_TRACE_SLICE:
+            t->in_slice = true;
+            t->waited = false;
+            t->slice_at = ts;
+            t->slice_pc = r->pc;
+            t->executed = 0;
+            break;
+        case VM_TRACE_WAIT:
+            t->waited = true;
+            if(!t->waiting) t->wait_at = ts;
+            t->waiting = true;
+            break;
+        case VM_TRACE_YIELD:
+            if(t->in_slice){
+                snprintf(args, sizeof(args), "\"pc\": %u, \"instructions\": %llu", (unsigned)t->slice_pc, (unsigned long long)t->executed);
+                traceEvent(&out, "slice", "tdm", "X", t->slice_at, ts - t->slice_at, r->thread, args);
+            }
+            if(t->waiting && !t->waited){
+                snprintf(args, sizeof(args), "\"pc\": %u", (unsigned)t->slice_pc);
+                traceEvent(&out, "wait", "network", "X", t->wait_at, t->slice_at - t->wait_at, r->thread, args);
+                t->waiting = false;
+            }
+            t->in_slice = false;
+            break;
+        case VM_TRACE_LOCK:
+            t->locked = true;
+            t->lock_at = ts;
+            break;
+        case VM_TRACE_UNLOCK:
+            if(t->locked){
+                snprintf(args, sizeof(args), "\"pc\": %u", (unsigned)r->pc);
+                traceEvent(&out, "locked", "lock", "X", t->lock_at, ts - t->lock_at, r->thread, args);
+            }
+            t->locked = false;
+            break;
+        case VM_TRACE_HALT:
+            snprintf(args, sizeof(args), "\"pc\": %u", (unsigned)r->pc);
+            traceEvent(&out, "halt", "halt", "i", ts, 0, r->thread, args);
+            break;
+        default:
+            break;
+        }
+    }
+
+    fprintf(out.out, "\n]}\n");
+    vm_bool ok = ferror(out.out) == 0;
+    if(out.out != stdout) ok = fclose(out.out) == 0 && ok;
+
+    free(thread);
+    free(record);
+    return ok ? 0 : 1;
+}